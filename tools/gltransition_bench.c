@@ -0,0 +1,346 @@
+/*
+ * Renders every gl-transition of a directory through the gltransition
+ * filter alone, without decoding or encoding anything, and reports the
+ * throughput and the per stage times the filter measures with timing=1.
+ *
+ * Build against an ffmpeg that has the filter:
+ *   cc -O2 -o gltransition_bench tools/gltransition_bench.c \
+ *     $(pkg-config --cflags --libs libavfilter libavutil)
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+#include "libavfilter/buffersrc.h"
+#include "libavutil/avstring.h"
+#include "libavutil/frame.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/parseutils.h"
+#include "libavutil/pixdesc.h"
+#include "libavutil/time.h"
+
+enum { UPLOAD, DRAW, READBACK, CPU, NB_STAGES };
+static const char *const stage_keys[NB_STAGES] = {
+  "lavfi.gltransition.upload_ms",
+  "lavfi.gltransition.draw_ms",
+  "lavfi.gltransition.readback_ms",
+  "lavfi.gltransition.cpu_ms",
+};
+
+typedef struct {
+  int w, h;
+  enum AVPixelFormat pix_fmt;
+  int frames;
+  const char *from_file;
+  const char *to_file;
+  const char *filter_opts;
+  double budget;  // ms of average draw time allowed, 0 for none
+} BenchOptions;
+
+typedef struct {
+  double fps;
+  double setup_ms;  // graph configuration, context and program creation
+  double stage_ms[NB_STAGES];
+  long gpu_memory_kb;
+} BenchResult;
+
+static int cmp_names(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void free_sources(char **names, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++) {
+    av_free(names[i]);
+  }
+  av_free(names);
+}
+
+// Collects the .glsl files of a directory in name order.
+static int list_sources(const char *dir, char ***names)
+{
+  DIR *d = opendir(dir);
+  struct dirent *e;
+  int n = 0;
+
+  *names = NULL;
+  if (!d) {
+    fprintf(stderr, "cannot open %s\n", dir);
+    return AVERROR(errno);
+  }
+  while ((e = readdir(d))) {
+    size_t len = strlen(e->d_name);
+    char **tmp;
+    if (len < 5 || strcmp(e->d_name + len - 5, ".glsl")) {
+      continue;
+    }
+    if ((tmp = av_realloc_array(*names, n + 1, sizeof(*tmp)))) {
+      *names = tmp;
+    }
+    if (!tmp || !(tmp[n] = av_asprintf("%s/%s", dir, e->d_name))) {
+      free_sources(*names, n);
+      *names = NULL;
+      closedir(d);
+      return AVERROR(ENOMEM);
+    }
+    n++;
+  }
+  closedir(d);
+  qsort(*names, n, sizeof(**names), cmp_names);
+  return n;
+}
+
+// Fills a frame with a gradient, or with one raw frame of the right format
+// and size read from a file.
+static AVFrame *make_frame(const BenchOptions *o, const char *file, int seed)
+{
+  AVFrame *frame = av_frame_alloc();
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(o->pix_fmt);
+  int p, x, y;
+
+  if (!frame) {
+    return NULL;
+  }
+  frame->width = o->w;
+  frame->height = o->h;
+  frame->format = o->pix_fmt;
+  frame->sample_aspect_ratio = (AVRational){ 1, 1 };
+  if (av_frame_get_buffer(frame, 32) < 0) {
+    av_frame_free(&frame);
+    return NULL;
+  }
+
+  if (file) {
+    int size = av_image_get_buffer_size(o->pix_fmt, o->w, o->h, 1);
+    uint8_t *buf = av_malloc(size);
+    FILE *f = fopen(file, "rb");
+    int ok = buf && f && fread(buf, size, 1, f) == 1;
+    if (f) {
+      fclose(f);
+    }
+    if (ok) {
+      const uint8_t *src[4];
+      int linesize[4];
+      av_image_fill_arrays((uint8_t **)src, linesize, buf, o->pix_fmt, o->w, o->h, 1);
+      av_image_copy(frame->data, frame->linesize, src, linesize, o->pix_fmt, o->w, o->h);
+    } else {
+      fprintf(stderr, "cannot read a %dx%d %s frame from %s\n", o->w, o->h, desc->name, file);
+      av_frame_free(&frame);
+    }
+    av_free(buf);
+    return frame;
+  }
+
+  for (p = 0; p < 4 && frame->data[p]; p++) {
+    int ph = p == 1 || p == 2 ? AV_CEIL_RSHIFT(o->h, desc->log2_chroma_h) : o->h;
+    for (y = 0; y < ph; y++) {
+      for (x = 0; x < frame->linesize[p]; x++) {
+        frame->data[p][y * frame->linesize[p] + x] = (x + y + seed * 64) * (p + 1);
+      }
+    }
+  }
+  return frame;
+}
+
+static int create_source(AVFilterGraph *graph, AVFilterContext **src, const char *name, const BenchOptions *o)
+{
+  char args[256];
+  snprintf(args, sizeof(args), "video_size=%dx%d:pix_fmt=%s:time_base=1/25:pixel_aspect=1/1:frame_rate=25/1",
+           o->w, o->h, av_get_pix_fmt_name(o->pix_fmt));
+  return avfilter_graph_create_filter(src, avfilter_get_by_name("buffer"), name, args, NULL, graph);
+}
+
+static int drain(AVFilterContext *sink, AVFrame *out, BenchResult *r, int *counts, int *received)
+{
+  int ret, i;
+
+  while ((ret = av_buffersink_get_frame(sink, out)) >= 0) {
+    AVDictionaryEntry *e;
+    for (i = 0; i < NB_STAGES; i++) {
+      if ((e = av_dict_get(out->metadata, stage_keys[i], NULL, 0))) {
+        r->stage_ms[i] += strtod(e->value, NULL);
+        counts[i]++;
+      }
+    }
+    if ((e = av_dict_get(out->metadata, "lavfi.gltransition.gpu_memory_kb", NULL, 0))) {
+      r->gpu_memory_kb = strtol(e->value, NULL, 10);
+    }
+    (*received)++;
+    av_frame_unref(out);
+  }
+  return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+// Runs o->frames frames through from+to -> gltransition -> sink, the
+// transition spanning all of them.
+static int bench_source(const char *source, const BenchOptions *o, AVFrame *from, AVFrame *to, BenchResult *r)
+{
+  AVFilterGraph *graph = avfilter_graph_alloc();
+  AVFilterContext *fromSrc, *toSrc, *transition, *sink;
+  AVFrame *out = av_frame_alloc();
+  int counts[NB_STAGES] = { 0 };
+  int received = 0;
+  char args[1024];
+  int64_t start;
+  int ret, i;
+
+  memset(r, 0, sizeof(*r));
+  if (!graph || !out) {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  snprintf(args, sizeof(args), "w=%d:h=%d:duration=%f:timing=1%s%s%s%s%s",
+           o->w, o->h, o->frames / 25.0,
+           source ? ":source='" : "", source ? source : "", source ? "'" : "",
+           o->filter_opts ? ":" : "", o->filter_opts ? o->filter_opts : "");
+  if ((ret = create_source(graph, &fromSrc, "from", o)) < 0 ||
+      (ret = create_source(graph, &toSrc, "to", o)) < 0 ||
+      (ret = avfilter_graph_create_filter(&transition, avfilter_get_by_name("gltransition"), "gltransition", args, NULL, graph)) < 0 ||
+      (ret = avfilter_graph_create_filter(&sink, avfilter_get_by_name("buffersink"), "sink", NULL, NULL, graph)) < 0 ||
+      (ret = avfilter_link(fromSrc, 0, transition, 0)) < 0 ||
+      (ret = avfilter_link(toSrc, 0, transition, 1)) < 0 ||
+      (ret = avfilter_link(transition, 0, sink, 0)) < 0) {
+    goto end;
+  }
+
+  start = av_gettime_relative();
+  if ((ret = avfilter_graph_config(graph, NULL)) < 0) {
+    goto end;
+  }
+  r->setup_ms = (av_gettime_relative() - start) / 1000.0;
+
+  start = av_gettime_relative();
+  for (i = 0; i < o->frames; i++) {
+    from->pts = to->pts = i;
+    if ((ret = av_buffersrc_add_frame_flags(fromSrc, from, AV_BUFFERSRC_FLAG_KEEP_REF)) < 0 ||
+        (ret = av_buffersrc_add_frame_flags(toSrc, to, AV_BUFFERSRC_FLAG_KEEP_REF)) < 0 ||
+        (ret = drain(sink, out, r, counts, &received)) < 0) {
+      goto end;
+    }
+  }
+  if ((ret = av_buffersrc_add_frame(fromSrc, NULL)) < 0 ||
+      (ret = av_buffersrc_add_frame(toSrc, NULL)) < 0 ||
+      (ret = drain(sink, out, r, counts, &received)) < 0) {
+    goto end;
+  }
+  r->fps = received * 1e6 / FFMAX(av_gettime_relative() - start, 1);
+  for (i = 0; i < NB_STAGES; i++) {
+    r->stage_ms[i] = counts[i] ? r->stage_ms[i] / counts[i] : -1;
+  }
+
+end:
+  av_frame_free(&out);
+  avfilter_graph_free(&graph);
+  return ret;
+}
+
+static void usage(void)
+{
+  fprintf(stderr,
+          "usage: gltransition_bench [options] <directory of .glsl files>\n"
+          "  -s WxH      frame size (default 1920x1080)\n"
+          "  -pix_fmt F  pixel format (default rgb24)\n"
+          "  -n N        frames per transition (default 250)\n"
+          "  -from FILE  raw frame of the given size and format shown first\n"
+          "  -to FILE    raw frame shown last\n"
+          "  -opts O     extra gltransition options, e.g. readback_depth=3\n"
+          "  -budget MS  fail when a transition draws slower than MS on average\n");
+}
+
+int main(int argc, char **argv)
+{
+  BenchOptions o = { 1920, 1080, AV_PIX_FMT_RGB24, 250 };
+  const char *dir = NULL;
+  AVFrame *from = NULL, *to = NULL;
+  char **sources = NULL;
+  int nb_sources, over = 0, failed = 0;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (arg[0] != '-') {
+      dir = arg;
+      continue;
+    }
+    if (!val) {
+      usage();
+      return 1;
+    }
+    i++;
+    if (!strcmp(arg, "-s")) {
+      if (av_parse_video_size(&o.w, &o.h, val) < 0) {
+        fprintf(stderr, "invalid size %s\n", val);
+        return 1;
+      }
+    } else if (!strcmp(arg, "-pix_fmt")) {
+      if ((o.pix_fmt = av_get_pix_fmt(val)) == AV_PIX_FMT_NONE) {
+        fprintf(stderr, "invalid pixel format %s\n", val);
+        return 1;
+      }
+    } else if (!strcmp(arg, "-n")) {
+      o.frames = FFMAX(atoi(val), 1);
+    } else if (!strcmp(arg, "-from")) {
+      o.from_file = val;
+    } else if (!strcmp(arg, "-to")) {
+      o.to_file = val;
+    } else if (!strcmp(arg, "-opts")) {
+      o.filter_opts = val;
+    } else if (!strcmp(arg, "-budget")) {
+      o.budget = strtod(val, NULL);
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (!dir) {
+    usage();
+    return 1;
+  }
+  // the filter logs its own summary of every run, the table is enough
+  av_log_set_level(AV_LOG_WARNING);
+
+  if ((nb_sources = list_sources(dir, &sources)) < 0) {
+    return 1;
+  }
+  if (!(from = make_frame(&o, o.from_file, 0)) || !(to = make_frame(&o, o.to_file, 1))) {
+    return 1;
+  }
+
+  printf("%-32s %9s %9s %9s %9s %9s %9s %9s\n",
+         "transition", "fps", "setup", "upload", "draw", "readback", "cpu", "gpu kB");
+  // the built in fade first, as a baseline
+  for (i = -1; i < nb_sources; i++) {
+    const char *source = i < 0 ? NULL : sources[i];
+    const char *name = source ? strrchr(source, '/') + 1 : "(fade)";
+    BenchResult r;
+    int ret = bench_source(source, &o, from, to, &r);
+    int over_budget;
+
+    if (ret < 0) {
+      printf("%-32s failed: %s\n", name, av_err2str(ret));
+      failed++;
+      continue;
+    }
+    // a draw time that was never measured can't be shown to be within it
+    over_budget = o.budget > 0 && (r.stage_ms[DRAW] < 0 || r.stage_ms[DRAW] > o.budget);
+    printf("%-32s %9.1f %9.3f %9.3f %9.3f %9.3f %9.3f %9ld%s\n", name, r.fps, r.setup_ms,
+           r.stage_ms[UPLOAD], r.stage_ms[DRAW], r.stage_ms[READBACK], r.stage_ms[CPU], r.gpu_memory_kb,
+           over_budget ? (r.stage_ms[DRAW] < 0 ? "  not measured" : "  over budget") : "");
+    over += over_budget;
+  }
+
+  free_sources(sources, nb_sources);
+  av_frame_free(&from);
+  av_frame_free(&to);
+  return failed || over ? 1 : 0;
+}
@@ -0,0 +1,247 @@
+/*
+ * Packs every gl-transition of a directory into one bundle the filter maps
+ * at once, used as source=lib.gltb:name with the file name of a transition
+ * without its .glsl. With -cache, the program binaries a cache_dir holds
+ * are packed too, so that instances on the drivers which linked them skip
+ * compiling.
+ *
+ * Build against the ffmpeg that has the filter:
+ *   cc -O2 -o gltransition_bundle tools/gltransition_bundle.c \
+ *     $(pkg-config --cflags --libs libavutil)
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/common.h"
+#include "libavutil/file.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/mem.h"
+
+// the layout read by vf_gltransition.c
+#define PROGRAM_KEY_SIZE   (32)
+#define PROGRAM_MAGIC      MKTAG('G', 'L', 'T', 'P')
+#define BUNDLE_MAGIC       MKTAG('G', 'L', 'T', 'B')
+#define BUNDLE_VERSION     (1)
+#define BUNDLE_HEADER_SIZE (16)
+#define BUNDLE_NAME_SIZE   (64)
+#define BUNDLE_SOURCE_SIZE (BUNDLE_NAME_SIZE + 8)
+#define BUNDLE_BINARY_SIZE (PROGRAM_KEY_SIZE + 12)
+
+typedef struct {
+  char name[BUNDLE_NAME_SIZE];  // or the program key of a binary
+  uint32_t format;
+  uint8_t *data;
+  size_t size;
+} Entry;
+
+static int cmp_names(const void *a, const void *b)
+{
+  return strcmp(((const Entry *)a)->name, ((const Entry *)b)->name);
+}
+
+static int cmp_keys(const void *a, const void *b)
+{
+  return memcmp(((const Entry *)a)->name, ((const Entry *)b)->name, PROGRAM_KEY_SIZE);
+}
+
+// Fills in an entry from a .glsl file, or from a program binary stored by
+// the filter in cache_dir under the hex of its key.
+static int read_entry(const char *dir, const char *file, int binary, Entry *e)
+{
+  char *path = av_asprintf("%s/%s", dir, file);
+  uint8_t *data;
+  size_t size;
+  int i, ret;
+
+  memset(e, 0, sizeof(*e));
+  if (!path) {
+    return AVERROR(ENOMEM);
+  }
+  ret = av_file_map(path, &data, &size, 0, NULL);
+  av_free(path);
+  if (ret < 0) {
+    fprintf(stderr, "cannot read %s/%s\n", dir, file);
+    return ret;
+  }
+
+  if (binary) {
+    // the header is in the byte order of the machine that wrote it
+    uint32_t header[2] = { 0 };
+    if (size > 8) {
+      memcpy(header, data, sizeof(header));
+    }
+    for (i = 0; i < PROGRAM_KEY_SIZE; i++) {
+      unsigned byte;
+      if (sscanf(file + 2 * i, "%2x", &byte) != 1) {
+        break;
+      }
+      e->name[i] = byte;
+    }
+    if (i < PROGRAM_KEY_SIZE || size <= 8 || header[0] != PROGRAM_MAGIC) {
+      fprintf(stderr, "skipping %s/%s, not a program binary\n", dir, file);
+      av_file_unmap(data, size);
+      return 0;
+    }
+    e->format = header[1];
+    e->size = size - 8;
+  } else {
+    size_t len = strlen(file) - 5;
+    if (len >= BUNDLE_NAME_SIZE) {
+      fprintf(stderr, "skipping %s/%s, name too long\n", dir, file);
+      av_file_unmap(data, size);
+      return 0;
+    }
+    memcpy(e->name, file, len);
+    e->size = size;
+  }
+  if (!(e->data = av_malloc(e->size))) {
+    av_file_unmap(data, size);
+    return AVERROR(ENOMEM);
+  }
+  memcpy(e->data, data + (binary ? 8 : 0), e->size);
+  av_file_unmap(data, size);
+  return 1;
+}
+
+// Reads the files of a directory ending with suffix, in the bundle order.
+static int read_entries(const char *dir, const char *suffix, int binary, Entry **entries)
+{
+  DIR *d = opendir(dir);
+  struct dirent *de;
+  size_t slen = strlen(suffix);
+  int n = 0, ret;
+
+  *entries = NULL;
+  if (!d) {
+    fprintf(stderr, "cannot open %s\n", dir);
+    return AVERROR(errno);
+  }
+  while ((de = readdir(d))) {
+    size_t len = strlen(de->d_name);
+    Entry *tmp;
+    if (len <= slen || strcmp(de->d_name + len - slen, suffix)) {
+      continue;
+    }
+    if (!(tmp = av_realloc_array(*entries, n + 1, sizeof(*tmp)))) {
+      closedir(d);
+      return AVERROR(ENOMEM);
+    }
+    *entries = tmp;
+    if ((ret = read_entry(dir, de->d_name, binary, &tmp[n])) < 0) {
+      closedir(d);
+      return ret;
+    }
+    n += ret;
+  }
+  closedir(d);
+  qsort(*entries, n, sizeof(**entries), binary ? cmp_keys : cmp_names);
+  return n;
+}
+
+static int write_bundle(const char *path, const Entry *sources, int nb_sources,
+                        const Entry *binaries, int nb_binaries)
+{
+  FILE *f = fopen(path, "wb");
+  uint8_t header[BUNDLE_HEADER_SIZE], entry[BUNDLE_SOURCE_SIZE + BUNDLE_BINARY_SIZE];
+  uint64_t offset = BUNDLE_HEADER_SIZE + (uint64_t)nb_sources * BUNDLE_SOURCE_SIZE +
+                    (uint64_t)nb_binaries * BUNDLE_BINARY_SIZE;
+  int i, ok;
+
+  if (!f) {
+    fprintf(stderr, "cannot create %s\n", path);
+    return AVERROR(errno);
+  }
+  AV_WL32(header, BUNDLE_MAGIC);
+  AV_WL32(header + 4, BUNDLE_VERSION);
+  AV_WL32(header + 8, nb_sources);
+  AV_WL32(header + 12, nb_binaries);
+  ok = fwrite(header, sizeof(header), 1, f) == 1;
+
+  for (i = 0; i < nb_sources && ok; i++) {
+    memcpy(entry, sources[i].name, BUNDLE_NAME_SIZE);
+    AV_WL32(entry + BUNDLE_NAME_SIZE, offset);
+    AV_WL32(entry + BUNDLE_NAME_SIZE + 4, sources[i].size);
+    ok = fwrite(entry, BUNDLE_SOURCE_SIZE, 1, f) == 1;
+    // sources are NUL terminated and used in place
+    offset += sources[i].size + 1;
+  }
+  for (i = 0; i < nb_binaries && ok; i++) {
+    memcpy(entry, binaries[i].name, PROGRAM_KEY_SIZE);
+    AV_WL32(entry + PROGRAM_KEY_SIZE, binaries[i].format);
+    AV_WL32(entry + PROGRAM_KEY_SIZE + 4, offset);
+    AV_WL32(entry + PROGRAM_KEY_SIZE + 8, binaries[i].size);
+    ok = fwrite(entry, BUNDLE_BINARY_SIZE, 1, f) == 1;
+    offset += binaries[i].size;
+  }
+  if (offset > UINT32_MAX) {
+    fprintf(stderr, "bundle over 4 GB\n");
+    ok = 0;
+  }
+
+  for (i = 0; i < nb_sources && ok; i++) {
+    ok = fwrite(sources[i].data, sources[i].size, 1, f) == 1 && fputc(0, f) == 0;
+  }
+  for (i = 0; i < nb_binaries && ok; i++) {
+    ok = fwrite(binaries[i].data, binaries[i].size, 1, f) == 1;
+  }
+  ok = !fclose(f) && ok;
+  if (!ok) {
+    fprintf(stderr, "writing %s failed\n", path);
+    remove(path);
+    return AVERROR(EIO);
+  }
+  return 0;
+}
+
+static void usage(void)
+{
+  fprintf(stderr,
+          "usage: gltransition_bundle [-cache DIR] OUT.gltb DIR\n"
+          "  -cache DIR   also pack the program binaries of a cache_dir\n");
+}
+
+int main(int argc, char **argv)
+{
+  const char *cache = NULL, *out = NULL, *dir = NULL;
+  Entry *sources = NULL, *binaries = NULL;
+  int nb_sources, nb_binaries = 0, ret;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-cache") && i + 1 < argc) {
+      cache = argv[++i];
+    } else if (argv[i][0] == '-') {
+      usage();
+      return 1;
+    } else if (!out) {
+      out = argv[i];
+    } else {
+      dir = argv[i];
+    }
+  }
+  if (!out || !dir) {
+    usage();
+    return 1;
+  }
+
+  if ((nb_sources = read_entries(dir, ".glsl", 0, &sources)) < 0 ||
+      (cache && (nb_binaries = read_entries(cache, ".bin", 1, &binaries)) < 0)) {
+    return 1;
+  }
+  ret = write_bundle(out, sources, nb_sources, binaries, nb_binaries);
+  if (ret >= 0) {
+    printf("%s: %d transitions, %d program binaries\n", out, nb_sources, nb_binaries);
+  }
+  for (i = 0; i < nb_sources; i++)
+    av_free(sources[i].data);
+  for (i = 0; i < nb_binaries; i++)
+    av_free(binaries[i].data);
+  av_free(sources);
+  av_free(binaries);
+  return ret < 0;
+}
@@ -6,7 +6,16 @@
 
 #include "libavutil/opt.h"
 #include "libavutil/avstring.h"
+#include "libavutil/cpu.h"
+#include "libavutil/file.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/pixdesc.h"
+#include "libavutil/sha.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
 #include "internal.h"
+#include "filters.h"
 #include "framesync.h"
 
 #ifndef __APPLE__
@@ -23,28 +32,168 @@
 
 #ifdef GL_TRANSITION_USING_EGL
 # include <EGL/egl.h>
+# include <EGL/eglext.h>
+# include <unistd.h>
 #else
 # include <GLFW/glfw3.h>
 #endif
 
+// VAAPI surfaces and Vulkan images are mapped to DRM PRIME and imported as
+// EGL images, rendering stays on GL either way
+#if defined(GL_TRANSITION_USING_EGL) && CONFIG_LIBDRM && (CONFIG_VAAPI || CONFIG_VULKAN)
+# define GL_TRANSITION_HWMAP_DRM
+# include <drm_fourcc.h>
+# include "libavutil/hwcontext_drm.h"
+# if CONFIG_VULKAN
+#  include "libavutil/hwcontext_vulkan.h"
+# endif
+# ifndef DRM_FORMAT_R16
+#  define DRM_FORMAT_R16 fourcc_code('R', '1', '6', ' ')
+# endif
+# ifndef DRM_FORMAT_GR1616
+#  define DRM_FORMAT_GR1616 fourcc_code('G', 'R', '3', '2')
+# endif
+#endif
+
+// CUDA frames are copied on the device into textures registered with CUDA
+#if CONFIG_CUDA
+# define GL_TRANSITION_HWMAP_CUDA
+# include "libavutil/hwcontext_cuda_internal.h"
+# include "libavutil/cuda_check.h"
+# define CHECK_CU(x) FF_CUDA_CHECK_DL(ctx, c->cuda->internal->cuda_dl, x)
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <stdatomic.h>
 #include <float.h>
 
-#define FROM (0)
-#define TO   (1)
+// hand-written kernels of the CPU backend, picked at run time from what
+// av_get_cpu_flags() reports. The x86 ones are compiled for their own target
+// whatever the file is built for, NEON comes with the arm target.
+#if ARCH_X86 && defined(__GNUC__)
+# define CPU_X86_KERNELS
+# define TARGET(t) __attribute__((target(t)))
+# include <immintrin.h>
+#elif defined(__ARM_NEON)
+# define CPU_NEON_KERNELS
+# include <arm_neon.h>
+#endif
+
+#define FROM   (0)
+#define TO     (1)
+#define OUTPUT (2)
+
+#define MAX_PLANES (3)
+
+// EGL devices considered by the device option
+#define MAX_EGL_DEVICES (32)
+
+// programs are cached by the SHA-256 of their sources and of the driver
+#define PROGRAM_KEY_SIZE (32)
+#define PROGRAM_MAGIC    MKTAG('G', 'L', 'T', 'P')
+
+// Transition library bundle: a header of magic, version and the number of
+// sources and of program binaries, the index of sources sorted by name, the
+// index of binaries sorted by program key, and the data they point to, every
+// source followed by a NUL. Integers are 32 bit little endian.
+#define BUNDLE_MAGIC       MKTAG('G', 'L', 'T', 'B')
+#define BUNDLE_VERSION     (1)
+#define BUNDLE_HEADER_SIZE (16)
+#define BUNDLE_NAME_SIZE   (64)
+#define BUNDLE_SOURCE_SIZE (BUNDLE_NAME_SIZE + 8)
+#define BUNDLE_BINARY_SIZE (PROGRAM_KEY_SIZE + 12)
+#define BUNDLE_SUFFIX      ".gltb:"
+
+// stages measured with timing=1, the GPU ones through GL_TIME_ELAPSED
+// queries kept in a ring of TIMER_DEPTH frames so they are read back
+// only once available
+enum { STAGE_UPLOAD, STAGE_DRAW, STAGE_READBACK, STAGE_CPU, NB_STAGES };
+#define GPU_STAGES  (STAGE_CPU)
+#define TIMER_DEPTH (32)
+
+// texture unit of a plane of one of the inputs, the rendered RGB image used
+// by the YUV output passes comes right after them
+#define TEX_UNIT(input, plane) ((input) * MAX_PLANES + (plane))
+#define RGB_UNIT (TEX_UNIT(2, 0))
+// then the targets of the earlier passes of a multi-pass transition and the
+// copy of the previous output
+#define MAX_PASSES (6)
+#define PASS_UNIT(pass) (RGB_UNIT + 1 + (pass))
+#define PREVIOUS_UNIT (PASS_UNIT(MAX_PASSES))
+
+typedef struct {
+  GLint  internalFormat;
+  GLenum format;
+  GLenum type;
+  int    bpp;    // bytes per pixel
+  int    shift;  // log2 of the subsampling in both directions
+} PlaneFormat;
+
+typedef struct {
+  enum AVPixelFormat pix_fmt;
+  int nb_planes;
+  PlaneFormat planes[MAX_PLANES];
+  // for YUV formats, how the chroma pair is fetched from the chroma samplers
+  const GLchar *chroma;
+  // the fourth byte is padding, sampled as an opaque alpha
+  int opaque;
+} TransitionFormat;
 
-#define PIXEL_FORMAT (GL_RGB)
+static const TransitionFormat transition_formats[] = {
+  // native endian 32 bit pixels, bgra/bgr0 on little endian hosts, which
+  // most desktop drivers transfer without converting on the CPU
+  { AV_PIX_FMT_RGB32, 1, {
+      { GL_RGBA8, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 4, 0 } }, NULL },
+  { AV_PIX_FMT_0RGB32, 1, {
+      { GL_RGBA8, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 4, 0 } }, NULL, 1 },
+  { AV_PIX_FMT_RGBA, 1, {
+      { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, 0 } }, NULL },
+  { AV_PIX_FMT_RGB0, 1, {
+      { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, 0 } }, NULL, 1 },
+  { AV_PIX_FMT_RGB24, 1, {
+      { GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE, 3, 0 } }, NULL },
+  // native endian 16 bit samples and packed 10 bit pixels for HDR pipelines
+  { AV_PIX_FMT_RGBA64, 1, {
+      { GL_RGBA16, GL_RGBA, GL_UNSIGNED_SHORT, 8, 0 } }, NULL },
+  { AV_PIX_FMT_RGB48, 1, {
+      { GL_RGB16, GL_RGB, GL_UNSIGNED_SHORT, 6, 0 } }, NULL },
+#ifdef AV_PIX_FMT_X2RGB10
+  { AV_PIX_FMT_X2RGB10, 1, {
+      { GL_RGB10_A2, GL_BGRA, GL_UNSIGNED_INT_2_10_10_10_REV, 4, 0 } }, NULL, 1 },
+#endif
+  { AV_PIX_FMT_YUV420P, 3, {
+      { GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1, 0 },
+      { GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1, 1 },
+      { GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1, 1 } },
+    "vec2(texture2D(u, st).r, texture2D(v, st).r)" },
+  { AV_PIX_FMT_NV12, 2, {
+      { GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1, 0 },
+      { GL_RG8, GL_RG, GL_UNSIGNED_BYTE, 2, 1 } },
+    "texture2D(u, st).rg" },
+  // 10 bits in the high bits of each 16 bit sample, sampled as normalized 16 bit
+  { AV_PIX_FMT_P010, 2, {
+      { GL_R16, GL_RED, GL_UNSIGNED_SHORT, 2, 0 },
+      { GL_RG16, GL_RG, GL_UNSIGNED_SHORT, 4, 1 } },
+    "texture2D(u, st).rg" },
+};
 
 #ifdef GL_TRANSITION_USING_EGL
+// rendering goes to framebuffer objects, the surface only makes the context
+// current where the display can't do without one
 static const EGLint configAttribs[] = {
     EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
-    EGL_BLUE_SIZE, 8,
-    EGL_GREEN_SIZE, 8,
-    EGL_RED_SIZE, 8,
-    EGL_DEPTH_SIZE, 8,
     EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
     EGL_NONE};
+static const EGLint surfacelessAttribs[] = {
+    EGL_SURFACE_TYPE, 0,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_NONE};
+static const EGLint pbufferAttribs[] = {
+    EGL_WIDTH, 1,
+    EGL_HEIGHT, 1,
+    EGL_NONE};
 #endif
 static const float position[12] = {
   -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f, 1.0f
@@ -61,25 +210,125 @@ static const GLchar *v_shader_source =
 
 static const GLchar *f_shader_template =
   "varying vec2 _uv;\n"
-  "uniform sampler2D from;\n"
-  "uniform sampler2D to;\n"
   "uniform float progress;\n"
   "uniform float ratio;\n"
   "uniform mat3 mfrom;\n"
   "uniform mat3 mto;\n"    
   "\n"
+  "%s"
+  "\n"
+  "#line 0 0\n"
+  "\n%s\n"
+  "void main() {\n"
+  "  gl_FragColor = transition(_uv);\n"
+  "}\n";
+
+static const GLchar *f_rgb_sampler_source =
+  "uniform sampler2D from;\n"
+  "uniform sampler2D to;\n"
+  "\n"
   "vec4 getFromColor(vec2 uv) {\n"
   "  return texture2D(from, vec2(vec3(uv,1.) * mfrom));\n"
   "}\n"
   "\n"
   "vec4 getToColor(vec2 uv) {\n"
   "  return texture2D(to, vec2(vec3(uv,1.) * mto));\n"
+  "}\n";
+
+// YUV inputs are converted while sampling, with the same transparent black
+// border the RGB textures get from GL_CLAMP_TO_BORDER
+static const GLchar *f_yuv_sampler_template =
+  "#define CHROMA(u, v, st) %s\n"
+  "uniform sampler2D from;\n"
+  "uniform sampler2D from1;\n"
+  "uniform sampler2D from2;\n"
+  "uniform sampler2D to;\n"
+  "uniform sampler2D to1;\n"
+  "uniform sampler2D to2;\n"
+  "uniform mat4 yuvfrom;\n"
+  "uniform mat4 yuvto;\n"
+  "\n"
+  "vec4 getYUVColor(sampler2D y, sampler2D u, sampler2D v, mat4 csp, vec2 st) {\n"
+  "  if (st.x < 0. || st.x > 1. || st.y < 0. || st.y > 1.)\n"
+  "    return vec4(0.);\n"
+  "  return vec4((csp * vec4(texture2D(y, st).r, CHROMA(u, v, st), 1.)).rgb, 1.);\n"
   "}\n"
   "\n"
-  "#line 0 0\n"
-  "\n%s\n"
+  "vec4 getFromColor(vec2 uv) {\n"
+  "  return getYUVColor(from, from1, from2, yuvfrom, vec2(vec3(uv,1.) * mfrom));\n"
+  "}\n"
+  "\n"
+  "vec4 getToColor(vec2 uv) {\n"
+  "  return getYUVColor(to, to1, to2, yuvto, vec2(vec3(uv,1.) * mto));\n"
+  "}\n";
+
+// every transition can sample the earlier passes it declares and the
+// previous output, flipped to the orientation of its uv
+static const GLchar *f_pass_source =
+  "uniform sampler2D previous;\n"
+  "\n"
+  "vec4 getPassColor(sampler2D pass, vec2 uv) {\n"
+  "  return texture2D(pass, vec2(uv.x, 1.0 - uv.y));\n"
+  "}\n"
+  "\n"
+  "vec4 getPreviousColor(vec2 uv) {\n"
+  "  return getPassColor(previous, uv);\n"
+  "}\n";
+
+// the transition is rendered to an RGB texture first and then written to the
+// output planes, luma at full resolution and both chroma planes in one pass
+static const GLchar *f_luma_source =
+  "uniform sampler2D rgb;\n"
+  "uniform mat4 csp;\n"
+  "uniform vec2 size;\n"
   "void main() {\n"
-  "  gl_FragColor = transition(_uv);\n"
+  "  vec4 c = csp * vec4(texture2D(rgb, gl_FragCoord.xy / size).rgb, 1.);\n"
+  "  gl_FragColor = vec4(c.r);\n"
+  "}\n";
+
+static const GLchar *f_chroma_source =
+  "uniform sampler2D rgb;\n"
+  "uniform mat4 csp;\n"
+  "uniform vec2 size;\n"
+  "void main() {\n"
+  "  vec4 c = csp * vec4(texture2D(rgb, gl_FragCoord.xy / size).rgb, 1.);\n"
+  "  gl_FragData[0] = vec4(c.gb, 0., 1.);\n"
+  "  gl_FragData[1] = vec4(c.b);\n"
+  "}\n";
+
+// compute=1 replaces both passes: each invocation converts the samples
+// of one 32 bit word of the output planes, stored one after the other at
+// the given byte offsets with rows of the given byte sizes, so that they
+// are read back in one transfer
+static const GLchar *c_pack_source =
+  "#version 430\n"
+  "layout(local_size_x = 256) in;\n"
+  "layout(std430, binding = 0) writeonly buffer Pack { uint words[]; };\n"
+  "uniform sampler2D rgb;\n"
+  "uniform mat4 csp;\n"
+  "uniform int bytes;\n"        // per sample
+  "uniform int interleaved;\n"  // both chroma samples in plane 1
+  "uniform ivec2 sizes[3];\n"
+  "uniform int linesizes[3];\n"
+  "uniform int offsets[4];\n"   // offsets[3] is the end of the last plane
+  "void main() {\n"
+  "  int i = int(gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x) * 256 + int(gl_LocalInvocationID.x);\n"
+  "  int b = i * 4, p = 0, s;\n"
+  "  uint word = 0u;\n"
+  "  if (b >= offsets[3])\n"
+  "    return;\n"
+  "  while (b >= offsets[p + 1])\n"
+  "    p++;\n"
+  "  for (s = 0; s < 4; s += bytes) {\n"
+  "    int r = b + s - offsets[p], y = r / linesizes[p], x = r % linesizes[p] / bytes;\n"
+  "    int nc = p > 0 && interleaved != 0 ? 2 : 1;\n"
+  "    if (x / nc < sizes[p].x && y < sizes[p].y) {\n"
+  "      vec4 c = csp * vec4(texture(rgb, (vec2(x / nc, y) + 0.5) / vec2(sizes[p])).rgb, 1.);\n"
+  "      float v = p == 0 ? c.r : nc == 2 ? (x % 2 == 0 ? c.g : c.b) : p == 1 ? c.g : c.b;\n"
+  "      word |= uint(clamp(v, 0., 1.) * (bytes == 2 ? 65535. : 255.) + 0.5) << (s * 8);\n"
+  "    }\n"
+  "  }\n"
+  "  words[i] = word;\n"
   "}\n";
 
 // default to a basic fade effect
@@ -93,6 +342,170 @@ static const GLchar *f_default_transition_source =
   "}\n";
 
 enum ResizeType { CONTAIN, COVER, STRETCH, RESIZE_NB };
+enum Backend { BACKEND_AUTO, BACKEND_GL, BACKEND_CPU, BACKEND_NB };
+// what of the GL state exists, all of it unless lead_time is set
+enum Resources { RESOURCES_READY, RESOURCES_NONE, RESOURCES_WARMING, RESOURCES_RELEASED };
+
+// For a point uv of the output, where a transition rendered on the CPU
+// samples both inputs and the weight it gives to the second one, with the
+// progress and ratio uniforms of its GLSL version.
+typedef float (*CPUKernel)(float progress, float ratio, const float *uv, float *fromUV, float *toUV);
+
+typedef struct {
+  const char *name;  // file name of the gl-transitions source, without .glsl
+  const char *glsl;  // the stock source
+  CPUKernel kernel;
+  int sameUV;        // both inputs are sampled at uv
+  int uniform;       // the weight is the same all over the frame
+} CPUTransition;
+
+typedef union {
+  GLint i[4];
+  GLfloat f[4];
+} UniformValue;
+
+typedef struct {
+  const char *name;
+  int integer;  // set with glUniform*i
+  int n;        // components
+} UniformType;
+
+typedef struct {
+  char name[64];
+  const UniformType *type;
+  int hasDefault;
+  UniformValue def;
+} UniformDesc;
+
+typedef struct {
+  unsigned seq;
+  int index;       // in the uniform table, -1 to switch transitions instead
+  int transition;  // preloaded source switched to
+  UniformValue value;
+} UniformUpdate;
+
+// Uniforms a transition declares, with the defaults of its "// = value"
+// comments, parsed once per source and device.
+typedef struct UniformTable {
+  uint8_t key[PROGRAM_KEY_SIZE];
+  int nb_uniforms;
+  UniformDesc *uniforms;
+  struct UniformTable *next;
+} UniformTable;
+
+// Linked program as returned by glGetProgramBinary.
+typedef struct ProgramBinary {
+  uint8_t key[PROGRAM_KEY_SIZE];
+  GLenum format;
+  GLint size;
+  uint8_t *data;
+  struct ProgramBinary *next;
+} ProgramBinary;
+
+// Display and root context opened once per process for every instance asking
+// for the same device, the instance contexts all being in the share group of
+// the root one.
+typedef struct GLDevice {
+  char *key;
+  int refcount;
+  int glewReady;
+#ifdef GL_TRANSITION_USING_EGL
+  EGLDisplay dpy;
+  EGLConfig cfg;
+  EGLContext ctx;
+  int surfaceless;  // contexts can be made current without a surface
+  EGLSurface surf;  // 1x1 pbuffer the root context is made current with otherwise
+#else
+  GLFWwindow *window;
+#endif
+  // programs linked so far on the device, new instances load them instead
+  // of compiling the same sources again
+  ProgramBinary *programs;
+  UniformTable *uniformTables;
+  struct GLDevice *next;
+} GLDevice;
+
+// Bundle mapped once per process for every instance using it.
+typedef struct GLBundle {
+  char *path;
+  int refcount;
+  uint8_t *data;
+  size_t size;
+  int nb_sources;
+  int nb_binaries;
+  struct GLBundle *next;
+} GLBundle;
+
+static AVMutex device_lock = AV_MUTEX_INITIALIZER;
+static GLDevice *devices;
+static GLBundle *bundles;
+
+// render_thread=1: frames go to the thread rendering them and come back
+// through rings with a single producer and a single consumer, the producer
+// only advancing tail and the consumer only head
+#define RENDER_QUEUE (8)
+
+typedef struct {
+  AVFrame *frame;  // from frame of a job, NULL to flush, or a rendered frame
+  AVFrame *to;
+  float progress;
+  unsigned seq;    // uniform commands received before the frame
+  int flush;       // last frame of the window, see flushAfter
+} RenderJob;
+
+typedef struct {
+  RenderJob *slots;
+  unsigned size;  // a power of two, so indices stay in order past wrapping
+  atomic_uint head;
+  atomic_uint tail;
+} RenderRing;
+
+// Pass of a multi-pass transition drawn before the one giving the output,
+// into a texture at scale times the output size.
+typedef struct {
+  GLuint program;
+  GLint  progress;
+  GLint  yuvfrom;
+  GLint  yuvto;
+  GLint  *uniformLocs;
+  float  scale;
+  int    w, h;
+  GLuint tex;
+  GLuint fbo;
+} TransitionPass;
+
+// transition between two consecutive clips of a timeline, or one of the
+// sources preloaded by gltransition
+typedef struct {
+  char *source;   // NULL for the default fade
+  double duration;
+  double offset;  // output time the transition starts at, in seconds
+  GLuint program;
+  GLint progress;
+  GLint yuvfrom;
+  GLint yuvto;
+  const UniformTable *uniformTable;
+  GLint *uniformLocs;
+  TransitionPass *passes;
+  int nb_passes;
+} TimelineTransition;
+
+// Pixel pack buffer persistently mapped for output_pool > 0, whose slots
+// are the buffers of an AVBufferPool that output frames refer to. Frames
+// may outlive the instance, so this is freed by whichever of uninit and the
+// AVBufferPool is done last and holds a reference to the device, in whose
+// share group the buffer stays until it is deleted. The AVBufferPool does
+// that through the root context of the device.
+typedef struct {
+  GLDevice    *device;
+  GLuint      buf;
+  uint8_t     *ptr;
+  size_t      slotSize;
+  int         nb_slots;
+  int         allocated;  // slots the AVBufferPool created buffers for
+  AVBufferPool *pool;
+  atomic_int  refs;       // the instance and the AVBufferPool
+} OutputPool;
 
 typedef struct {
   const AVClass *class;
@@ -101,45 +514,268 @@ typedef struct {
   // input options
   double duration;
   double offset;
+  double fixed_progress;  // used instead of the timestamps when not negative
   enum ResizeType resize;
+  int passthrough;
+  int static_from;
+  int static_to;
+  int shared;
+  enum Backend backend;
   
   char *source;
+  char *cache_dir;
+  // bundles the transition sources were found in, their binaries being
+  // tried before those of cache_dir
+  GLBundle **bundles;
+  int nb_bundles;
+  char *device_name;
+  AVDictionary *uniforms;  // values replacing the defaults of the transition
 
   // output options
   unsigned w, h;
+  int readback_depth;
+  int upload_depth;
+  int batch;
+  int timing;
+  int render_thread;
+  int prescale;
+  int compute;
+  int output_pool;
+  int max_inflight;
+  double lead_time;
   
   // timestamp of the first frame in the output, in the timebase units
   int64_t first_pts;
+  // transition window in the framesync timebase, relative to first_pts:
+  // frames up to windowStart are at progress 0, those from windowEnd on at
+  // 1, and windowFirst/windowLast are the indices of the frames in between
+  // at the output frame rate
+  int64_t windowStart, windowEnd;
+  int64_t windowFirst, windowLast;
+  double  windowOffset, windowDuration;  // that it was computed for
+  int     flushAfter;  // the frame being drawn is the last of the window
 
   // uniforms
-  GLuint        from;
-  GLuint        to;
+  GLuint        tex[2][MAX_PLANES];
   GLint         progress;
+  GLint         yuvfrom;
+  GLint         yuvto;
 
   // internal state
+  const TransitionFormat *fmt;
+  const UniformTable *uniformTable;  // of the program being built
+  // process_command() state: trigger starts the transition at the next
+  // frame and uniform values wait in uniformUpdates, under renderLock when
+  // there is a render thread, until a frame coming after them is drawn
+  int           trigger;
+  GLint         *uniformLocs;
+  UniformUpdate *uniformUpdates;
+  int           nbUniformUpdates;
+  atomic_int    uniformsQueued;
+  unsigned      uniformSeq;  // commands received so far
+  unsigned      drawSeq;     // commands received before the frame being drawn
+  const CPUTransition *cpu;  // set when rendering on the CPU
+  float         cpuMatrix[2][9];  // mfrom and mto
+  // kernels for the CPU at hand, k and the weights in 1/256ths
+  void (*cpuBlend8)(uint8_t *dst, const uint8_t *a, const uint8_t *b, int n, int k);
+  void (*cpuFetch8x4)(const uint8_t *r0, const uint8_t *r1, int fx, int fy, int *v);
   GLuint        posBuf;
   GLuint        program;
+  // earlier passes of the program, and the last output kept for the
+  // previous sampler when a program uses it
+  TransitionPass *passes;
+  int           nb_passes;
+  GLuint        prevTex;
+
+  // RGB output is rendered into planeTex[0] through outFbo
+  GLuint        outFbo;
+
+  // offscreen targets and programs converting the rendered image back to
+  // the output planes when the negotiated format is YUV
+  GLuint        rgbTex;
+  GLuint        rgbFbo;
+  GLuint        planeTex[MAX_PLANES];
+  GLuint        lumaFbo;
+  GLuint        chromaFbo;
+  GLuint        lumaProgram;
+  GLuint        chromaProgram;
+  GLint         lumaCsp;
+  GLint         chromaCsp;
+
+  // compute=1: program packing the YUV planes into a shader storage buffer,
+  // the first of packBufs or the next one in the readback ring, from where
+  // they are read into a buffer of packPool that becomes the frame's
+  GLuint        computeProgram;
+  GLint         computeCsp;
+  int           packLinesizes[MAX_PLANES];
+  AVBufferPool  *packPool;
+
+  // ring of pixel pack buffers used when readback_depth > 1, each slot
+  // holding the output frame whose pixels are being read into it
+  GLuint        *packBufs;
+  AVFrame       **packFrames;
+  size_t        packOffsets[MAX_PLANES];
+  size_t        packSize;
+  int           packHead;
+  int           packQueued;
+  // output_pool > 0: the frames queued above are read into slots of
+  // outPool instead, each waiting on its fence
+  OutputPool    *outPool;
+  GLsync        *packFences;
+
+  // batch > 1: frame pairs queued until there are batch of them, then drawn
+  // into consecutive layers of the planeTex arrays and read back at once
+  AVFrame       **batchFrom;
+  AVFrame       **batchTo;
+  AVFrame       **batchOut;
+  float         *batchProgress;
+  unsigned      *batchSeq;
+  int           batchQueued;
+  AVBufferPool  *batchPool;     // the planes of batch layers, plane after plane
+  size_t        batchLayerSize[MAX_PLANES];
+  int           batchLinesizes[MAX_PLANES];
+
+  // persistently mapped pixel unpack ring used when upload_depth > 1, each
+  // slot holding one from/to pair and fenced until the draw sampling it ends
+  GLuint        uploadBuf;
+  uint8_t       *uploadPtr;
+  GLsync        *uploadFences;
+  size_t        uploadOffsets[2][MAX_PLANES];
+  size_t        uploadSlotSize;
+  int           uploadHead;
+
+  // prescale=1: log2 of the factor each input is shrunk by on the CPU
+  // before it is uploaded, and where frames uploaded without the ring are
+  // shrunk into
+  int           prescaleShift[2];
+  uint8_t       *prescaleBuf[2];
+
+  // references to the frames the from and to textures were last uploaded
+  // from, so that frames repeated by framesync aren't uploaded again
+  AVFrame       *uploaded[2];
+
+  // render_thread=1 state, activate() queuing jobs and sending out what
+  // comes back while the thread owning the context renders them; the lock
+  // and condition are only there to sleep while there is nothing to do, and
+  // only taken to wake a side its flag says is sleeping
+  int           renderRunning;
+  int           renderExit;
+  atomic_int    renderPending;  // jobs queued and not done yet
+  unsigned      renderTaken;    // frames queued and sent out, see render_thread_full()
+  unsigned      renderReturned;
+  atomic_int    renderSleeping;
+  atomic_int    graphSleeping;
+  atomic_int    renderError;
+  RenderRing    jobs;
+  RenderRing    done;
+  AVMutex       renderLock;
+  AVCond        renderCond;
+#if HAVE_THREADS
+  pthread_t     renderThread;
+#endif
+
+  // lead_time >= 0: the context and programs are made lead_time before the
+  // window by warmThread, and the frame resources released after it, to be
+  // made again if a command or trigger moves the window
+  enum Resources resources;
+  int           warmRunning;
+  int           warmResult;
+#if HAVE_THREADS
+  pthread_t     warmThread;
+#endif
+
+  // format of the hardware frames going through the filter, the textures
+  // then hold their surfaces and c->fmt describes the software layout;
+  // AV_PIX_FMT_NONE when frames are in memory
+  enum AVPixelFormat hwFormat;
+#ifdef GL_TRANSITION_HWMAP_DRM
+  AVFrame       *drmFrames[3];  // DRM mappings of the from, to and output frames
+  PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR;
+  PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR;
+  void          (*eglImageTargetTexture2DOES)(GLenum target, void *image);
+  int           drmModifiers;
+#endif
+#ifdef GL_TRANSITION_HWMAP_CUDA
+  AVCUDADeviceContext *cuda;
+  CUgraphicsResource cuRes[3][MAX_PLANES];  // from, to and output textures
+#endif
+  // timing=1 state, the queries of a frame are collected once the last
+  // of them is available and the newest results go out with the next frame
+  GLuint        timerQueries[TIMER_DEPTH][GPU_STAGES];
+  int           timerHead;
+  int           timerPending;
+  int64_t       blendStart;
+  float         gpuTimes[GPU_STAGES];  // ms, negative until measured
+  size_t        gpuMemory;             // textures, buffers and programs, bytes
+  float         *timingSamples[NB_STAGES];
+  int           nbTimingSamples[NB_STAGES];
+  int           timingSamplesSize[NB_STAGES];
+
+  GLDevice      *device;
 #ifdef GL_TRANSITION_USING_EGL
   EGLDisplay eglDpy;
-  EGLConfig eglCfg;
   EGLSurface eglSurf;
   EGLContext eglCtx;
 #else
   GLFWwindow    *window;
 #endif
 
+  // timeline: nb_clips inputs shown one after the other, clip i moving
+  // into clip i+1 through transitions[i]; gltransition only builds the
+  // programs of the sources and switches between them on trigger
+  int nb_clips;
+  char *sources;
+  char *durations;
+  char *offsets;
+  TimelineTransition *transitions;
+  int nb_transitions;
+  int selected;        // preloaded source the next frames are drawn with
+  int64_t *clipShift;  // added to the pts of a clip to place it on the output
+  int *clipEof;
+  int clip;            // clip being shown, or transitioned from
+  AVFrame *pending;    // next frame of that clip
+  AVFrame *last;       // last frame shown of that clip
+  AVFrame *toCur;      // frames of the next clip around the output time
+  AVFrame *toNext;
+
   GLchar *f_shader_source;
 } GLTransitionContext;
 
 #define OFFSET(x) offsetof(GLTransitionContext, x)
 #define FLAGS AV_OPT_FLAG_FILTERING_PARAM|AV_OPT_FLAG_VIDEO_PARAM
+#define TFLAGS FLAGS|AV_OPT_FLAG_RUNTIME_PARAM
 
 static const AVOption gltransition_options[] = {
-  { "duration", "transition duration in seconds", OFFSET(duration), AV_OPT_TYPE_DOUBLE, {.dbl=1.0}, 0, DBL_MAX, FLAGS },
-  { "offset", "delay before startingtransition in seconds", OFFSET(offset), AV_OPT_TYPE_DOUBLE, {.dbl=0.0}, 0, DBL_MAX, FLAGS },
+  { "duration", "transition duration in seconds", OFFSET(duration), AV_OPT_TYPE_DOUBLE, {.dbl=1.0}, 0, DBL_MAX, TFLAGS },
+  { "offset", "delay before startingtransition in seconds", OFFSET(offset), AV_OPT_TYPE_DOUBLE, {.dbl=0.0}, 0, DBL_MAX, TFLAGS },
+  { "progress", "progress to render at instead of following the timestamps when not negative", OFFSET(fixed_progress), AV_OPT_TYPE_DOUBLE, {.dbl=-1.0}, -1.0, 1.0, TFLAGS },
   { "source", "path to the gl-transition source file (defaults to basic fade)", OFFSET(source), AV_OPT_TYPE_STRING, {.str = NULL}, CHAR_MIN, CHAR_MAX, FLAGS },
+  { "sources", "'|' separated gl-transition sources built at init to switch between on trigger", OFFSET(sources), AV_OPT_TYPE_STRING, {.str = NULL}, CHAR_MIN, CHAR_MAX, FLAGS },
+  { "cache_dir", "directory keeping compiled program binaries across runs", OFFSET(cache_dir), AV_OPT_TYPE_STRING, {.str = NULL}, CHAR_MIN, CHAR_MAX, FLAGS },
+  { "device", "EGL device index or DRM node to render on, or auto", OFFSET(device_name), AV_OPT_TYPE_STRING, {.str = NULL}, CHAR_MIN, CHAR_MAX, FLAGS },
+  { "uniforms", "transition uniforms to set, as name=value pairs separated by :", OFFSET(uniforms), AV_OPT_TYPE_DICT, {.str = NULL}, 0, 0, FLAGS },
   { "w", "Output video width", OFFSET(w),    AV_OPT_TYPE_INT, {.i64=0}, 0,8192, FLAGS },
   { "h", "Output video height", OFFSET(h),    AV_OPT_TYPE_INT, {.i64=0}, 0,8192, FLAGS },
+  { "readback_depth", "number of frames read back asynchronously (adds depth-1 frames of delay)", OFFSET(readback_depth), AV_OPT_TYPE_INT, {.i64=1}, 1, 16, FLAGS },
+  { "passthrough", "send inputs through untouched outside of the transition", OFFSET(passthrough), AV_OPT_TYPE_BOOL, {.i64=-1}, -1, 1, FLAGS },
+  { "static_from", "upload the first from frame only", OFFSET(static_from), AV_OPT_TYPE_BOOL, {.i64=0}, 0, 1, FLAGS },
+  { "static_to", "upload the first to frame only", OFFSET(static_to), AV_OPT_TYPE_BOOL, {.i64=0}, 0, 1, FLAGS },
+  { "shared", "share GL objects with the other instances", OFFSET(shared), AV_OPT_TYPE_BOOL, {.i64=1}, 0, 1, FLAGS },
+  { "upload_depth", "number of frame pairs uploaded through a persistently mapped ring", OFFSET(upload_depth), AV_OPT_TYPE_INT, {.i64=1}, 1, 16, FLAGS },
+  { "prescale", "shrink inputs larger than drawn before uploading them", OFFSET(prescale), AV_OPT_TYPE_BOOL, {.i64=0}, 0, 1, FLAGS },
+  { "compute", "pack YUV output planes with a compute shader and read them back at once", OFFSET(compute), AV_OPT_TYPE_BOOL, {.i64=0}, 0, 1, FLAGS },
+  { "output_pool", "number of output frames read straight into a persistently mapped buffer", OFFSET(output_pool), AV_OPT_TYPE_INT, {.i64=0}, 0, 64, FLAGS },
+  { "max_inflight", "frames on the GPU at most, sizing the rings (0 leaves them as set)", OFFSET(max_inflight), AV_OPT_TYPE_INT, {.i64=0}, 0, 16, FLAGS, "max_inflight" },
+  { "live", "one frame at a time, for the lowest latency", 0, AV_OPT_TYPE_CONST, {.i64=1}, 0, 0, FLAGS, "max_inflight" },
+  { "throughput", "four frames overlapping", 0, AV_OPT_TYPE_CONST, {.i64=4}, 0, 0, FLAGS, "max_inflight" },
+  { "batch", "number of frames drawn before reading them back in one transfer", OFFSET(batch), AV_OPT_TYPE_INT, {.i64=1}, 1, 16, FLAGS },
+  { "timing", "export per stage GPU and CPU times as frame metadata", OFFSET(timing), AV_OPT_TYPE_BOOL, {.i64=0}, 0, 1, FLAGS },
+  { "render_thread", "render on a dedicated thread owning the GL context", OFFSET(render_thread), AV_OPT_TYPE_BOOL, {.i64=0}, 0, 1, FLAGS },
+  { "lead_time", "set up this many seconds before the transition and release after it (negative: at once)", OFFSET(lead_time), AV_OPT_TYPE_DOUBLE, {.dbl=-1.0}, -1.0, INT_MAX / AV_TIME_BASE, FLAGS },
+  { "backend", "renderer", OFFSET(backend), AV_OPT_TYPE_INT, {.i64=BACKEND_AUTO}, 0, BACKEND_NB-1, FLAGS, "backend" },
+  { "auto", "OpenGL, or the CPU when that fails", 0, AV_OPT_TYPE_CONST, {.i64=BACKEND_AUTO}, 0, 0, FLAGS, "backend" },
+  { "gl", "OpenGL", 0, AV_OPT_TYPE_CONST, {.i64=BACKEND_GL}, 0, 0, FLAGS, "backend" },
+  { "cpu", "slice threaded CPU renderer, for the transitions it knows", 0, AV_OPT_TYPE_CONST, {.i64=BACKEND_CPU}, 0, 0, FLAGS, "backend" },
   { "resize", "resize mode", OFFSET(resize), AV_OPT_TYPE_INT, {.i64=0}, 0, RESIZE_NB-1, FLAGS, "resize" },
   { "contain", "contain", 0, AV_OPT_TYPE_CONST, {.i64=CONTAIN}, 0, 0, FLAGS, "resize" },
   { "cover", "cover", 0, AV_OPT_TYPE_CONST, {.i64=COVER}, 0, 0, FLAGS, "resize" },
@@ -171,383 +807,5201 @@ static GLuint build_shader(AVFilterContext *ctx, const GLchar *shader_source, GL
   return (status == GL_TRUE ? shader : 0);
 }
 
-static int build_program(AVFilterContext *ctx)
+// Hashes everything a linked program depends on.
+static int program_key(const GLchar *f_source, uint8_t *key)
 {
-  GLint status;
-  GLuint v_shader, f_shader;
-  GLTransitionContext *c = ctx->priv;
-  char *source = NULL;
-  const char * transition_source;
-  int len;
+  const char *parts[] = {
+    (const char *)glGetString(GL_RENDERER),
+    (const char *)glGetString(GL_VERSION),
+    v_shader_source,
+    f_source,
+  };
+  struct AVSHA *sha = av_sha_alloc();
+  int i;
 
-  if (!(v_shader = build_shader(ctx, v_shader_source, GL_VERTEX_SHADER))) {
-    return -1;
+  if (!sha) {
+    return AVERROR(ENOMEM);
   }
-
-
-  if (c->source) {
-    FILE *f = fopen(c->source, "rb");
-    unsigned long fsize;
-    
-    if (!f) {
-      av_log(ctx, AV_LOG_ERROR, "invalid transition source file \"%s\"\n", c->source);
-      return -1;
+  av_sha_init(sha, 256);
+  for (i = 0; i < FF_ARRAY_ELEMS(parts); i++) {
+    // the terminators keep the parts apart
+    if (parts[i]) {
+      av_sha_update(sha, (const uint8_t *)parts[i], strlen(parts[i]) + 1);
     }
+  }
+  av_sha_final(sha, key);
+  av_free(sha);
+  return 0;
+}
 
-    fseek(f, 0, SEEK_END);
-    fsize = ftell(f);
-    fseek(f, 0, SEEK_SET);
+static int program_binaries_supported(void)
+{
+#ifndef __APPLE__
+  GLint formats = 0;
+  if (GLEW_ARB_get_program_binary) {
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  }
+  return formats > 0;
+#else
+  return 0;
+#endif
+}
 
-    source = malloc(fsize + 1);
-    fread(source, fsize, 1, f);
-    fclose(f);
+static char *program_path(GLTransitionContext *c, const uint8_t *key)
+{
+  char hex[2 * PROGRAM_KEY_SIZE + 1];
+  int i;
 
-    source[fsize] = 0;
+  for (i = 0; i < PROGRAM_KEY_SIZE; i++) {
+    snprintf(hex + 2 * i, 3, "%02x", key[i]);
   }
+  return av_asprintf("%s/%s.bin", c->cache_dir, hex);
+}
 
-  transition_source = source ? source : f_default_transition_source;
+// Reads a binary stored by write_program_file(), a magic and the binary
+// format followed by the binary itself.
+static ProgramBinary *read_program_file(AVFilterContext *ctx, const uint8_t *key)
+{
+  GLTransitionContext *c = ctx->priv;
+  char *path = program_path(c, key);
+  ProgramBinary *bin = NULL;
+  uint32_t header[2];
+  long size;
+  FILE *f;
 
-  len = strlen(f_shader_template) + strlen(transition_source);
-  c->f_shader_source = av_calloc(len, sizeof(*c->f_shader_source));
-  if (!c->f_shader_source) {
-    return AVERROR(ENOMEM);
+  if (!path || !(f = fopen(path, "rb"))) {
+    av_free(path);
+    return NULL;
   }
+  fseek(f, 0, SEEK_END);
+  size = ftell(f) - (long)sizeof(header);
+  fseek(f, 0, SEEK_SET);
 
-  snprintf(c->f_shader_source, len * sizeof(*c->f_shader_source), f_shader_template, transition_source);
-  av_log(ctx, AV_LOG_DEBUG, "\n%s\n", c->f_shader_source);
-
-  if (source) {
-    free(source);
-    source = NULL;
+  if (size > 0 && fread(header, sizeof(header), 1, f) == 1 && header[0] == PROGRAM_MAGIC &&
+      (bin = av_mallocz(sizeof(*bin))) && (bin->data = av_malloc(size)) &&
+      fread(bin->data, size, 1, f) == 1) {
+    memcpy(bin->key, key, PROGRAM_KEY_SIZE);
+    bin->format = header[1];
+    bin->size = size;
+    av_log(ctx, AV_LOG_VERBOSE, "read program binary %s\n", path);
+  } else if (bin) {
+    av_freep(&bin->data);
+    av_freep(&bin);
   }
+  fclose(f);
+  av_free(path);
+  return bin;
+}
 
-  if (!(f_shader = build_shader(ctx, c->f_shader_source, GL_FRAGMENT_SHADER))) {
-    return -1;
+static void write_program_file(AVFilterContext *ctx, const ProgramBinary *bin)
+{
+  GLTransitionContext *c = ctx->priv;
+  char *path = program_path(c, bin->key);
+  char *tmp = path ? av_asprintf("%s.XXXXXX", path) : NULL;
+  uint32_t header[2] = { PROGRAM_MAGIC, bin->format };
+  FILE *f = NULL;
+  int fd, ok;
+
+  // a name of its own so that concurrent writers never share a file
+  if (tmp && (fd = mkstemp(tmp)) >= 0 && !(f = fdopen(fd, "wb"))) {
+    close(fd);
+    remove(tmp);
   }
-  
-  c->program = glCreateProgram();
-  glAttachShader(c->program, v_shader);
-  glAttachShader(c->program, f_shader);
-  glLinkProgram(c->program);
+  if (f) {
+    ok = fwrite(header, sizeof(header), 1, f) == 1 && fwrite(bin->data, bin->size, 1, f) == 1;
+    ok = !fclose(f) && ok;
+    // moved into place so that other processes never read a partial file
+    if (!ok || rename(tmp, path)) {
+      remove(tmp);
+      f = NULL;
+    }
+  }
+  if (!f) {
+    av_log(ctx, AV_LOG_WARNING, "writing program binary to %s failed\n", c->cache_dir);
+  }
+  av_free(tmp);
+  av_free(path);
+}
 
-  glGetProgramiv(c->program, GL_LINK_STATUS, &status);
-  if (status != GL_TRUE) {
-    char log[10000];
-    glGetProgramInfoLog(c->program, sizeof(log), NULL, log);
-    av_log(ctx, AV_LOG_ERROR, "invalid program: %s\n", log);
+// Checks that the index of a bundle only points inside of it.
+static int check_bundle(const GLBundle *b)
+{
+  const uint8_t *e = b->data + BUNDLE_HEADER_SIZE;
+  int i;
+
+  if ((uint64_t)BUNDLE_HEADER_SIZE + (uint64_t)b->nb_sources * BUNDLE_SOURCE_SIZE +
+      (uint64_t)b->nb_binaries * BUNDLE_BINARY_SIZE > b->size) {
+    return 0;
+  }
+  for (i = 0; i < b->nb_sources; i++, e += BUNDLE_SOURCE_SIZE) {
+    uint64_t offset = AV_RL32(e + BUNDLE_NAME_SIZE), size = AV_RL32(e + BUNDLE_NAME_SIZE + 4);
+    if (!memchr(e, 0, BUNDLE_NAME_SIZE) || offset + size >= b->size || b->data[offset + size]) {
+      return 0;
+    }
+  }
+  for (i = 0; i < b->nb_binaries; i++, e += BUNDLE_BINARY_SIZE) {
+    uint64_t offset = AV_RL32(e + PROGRAM_KEY_SIZE + 4), size = AV_RL32(e + PROGRAM_KEY_SIZE + 8);
+    if (!size || offset + size > b->size) {
+      return 0;
+    }
   }
-  return status == GL_TRUE ? 0 : -1;
+  return 1;
 }
 
-static GLuint create_vbo(GLTransitionContext *c)
+// Unlinks and unmaps a bundle no instance refers to, with device_lock held.
+static void close_bundle(GLBundle *b)
 {
-  GLint loc;
-  GLuint buf;
-  glGenBuffers(1, &buf);
-  glBindBuffer(GL_ARRAY_BUFFER, buf);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(position), position, GL_STATIC_DRAW);
+  GLBundle **p;
 
-  loc = glGetAttribLocation(c->program, "position");
-  glEnableVertexAttribArray(loc);
-  glVertexAttribPointer(loc, 2, GL_FLOAT, GL_FALSE, 0, 0);
-  return buf;
+  for (p = &bundles; *p != b; p = &(*p)->next);
+  *p = b->next;
+  av_file_unmap(b->data, b->size);
+  av_free(b->path);
+  av_free(b);
 }
 
-static GLuint create_tex(unsigned w, unsigned h) {
-  GLuint t;
-  glGenTextures(1, &t);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, t);
+// Maps a bundle, or takes another reference to it when some instance has it
+// mapped already, and keeps it until uninit().
+static int open_bundle(AVFilterContext *ctx, const char *path, const GLBundle **out)
+{
+  GLTransitionContext *c = ctx->priv;
+  GLBundle *b;
+  int i, ret = 0;
 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  for (i = 0; i < c->nb_bundles; i++) {
+    if (!strcmp(c->bundles[i]->path, path)) {
+      *out = c->bundles[i];
+      return 0;
+    }
+  }
 
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, PIXEL_FORMAT, GL_UNSIGNED_BYTE, NULL);
-  return t;
+  ff_mutex_lock(&device_lock);
+  for (b = bundles; b && strcmp(b->path, path); b = b->next);
+  if (!b) {
+    if (!(b = av_mallocz(sizeof(*b))) || !(b->path = av_strdup(path))) {
+      ret = AVERROR(ENOMEM);
+    } else if ((ret = av_file_map(path, &b->data, &b->size, 0, ctx)) < 0) {
+      av_log(ctx, AV_LOG_ERROR, "invalid transition bundle \"%s\"\n", path);
+    } else if (b->size < BUNDLE_HEADER_SIZE || AV_RL32(b->data) != BUNDLE_MAGIC ||
+               AV_RL32(b->data + 4) != BUNDLE_VERSION ||
+               (b->nb_sources = AV_RL32(b->data + 8), b->nb_binaries = AV_RL32(b->data + 12),
+                b->nb_sources < 0 || b->nb_binaries < 0 || !check_bundle(b))) {
+      av_log(ctx, AV_LOG_ERROR, "\"%s\" is not a transition bundle\n", path);
+      av_file_unmap(b->data, b->size);
+      ret = AVERROR_INVALIDDATA;
+    } else {
+      b->next = bundles;
+      bundles = b;
+    }
+    if (ret < 0 && b) {
+      av_free(b->path);
+      av_freep(&b);
+    }
+  }
+  if (b && (ret = av_dynarray_add_nofree(&c->bundles, &c->nb_bundles, b)) < 0) {
+    // only just mapped when no other instance holds it
+    if (!b->refcount) {
+      close_bundle(b);
+    }
+  } else if (b) {
+    b->refcount++;
+    *out = b;
+  }
+  ff_mutex_unlock(&device_lock);
+  return ret;
 }
 
-static int streq(const char * s1, const char * s2) {
-  return s1 && s2 && !strcmp(s1,s2);
-}
+static void release_bundles(GLTransitionContext *c)
+{
+  int i;
 
-static void get_matrix(int method, float * m, float ratio, float xratio) {
-  float sx, sy;
-  memset(m, 0, 9*sizeof(float));
-  switch (method) {
-  case CONTAIN: 
-    sx = fmax(ratio/xratio, 1.f);
-    sy = fmax(xratio/ratio, 1.f); 
-    break;
-  case COVER:
-    sx = fmin(ratio/xratio, 1.f);
-    sy = fmin(xratio/ratio, 1.f);
-    break;
-  case STRETCH:
-    sx = 1;
-    sy = 1;
-    break;
+  ff_mutex_lock(&device_lock);
+  for (i = 0; i < c->nb_bundles; i++) {
+    GLBundle *b = c->bundles[i];
+    if (!--b->refcount) {
+      close_bundle(b);
+    }
   }
-  m[0] = sx;
-  m[2] = -0.5 * sx + 0.5;
-  m[4] = -sy;
-  m[5] = 0.5 * sy + 0.5;
-  m[8] = 1;
+  ff_mutex_unlock(&device_lock);
+  av_freep(&c->bundles);
+  c->nb_bundles = 0;
 }
 
-static void init_uniforms(AVFilterContext * ctx)
+static int cmp_bundle_name(const void *name, const void *entry)
 {
-  GLTransitionContext *c = ctx->priv;
-  AVFilterLink *fromLink = ctx->inputs[FROM];
-  AVFilterLink *toLink = ctx->inputs[TO];
-  AVFilterLink *outLink = ctx->outputs[0];
-  float mfrom[9];
-  float mto[9];
-  float ratio = outLink->w / (float)outLink->h;
-  float fromR = fromLink->w / (float)fromLink->h;
-  float toR = toLink->w / (float)toLink->h;  
-  char * src = strdup(c->f_shader_source);
-  char * st;
-  char * line;
-  line = strtok_r(src, "\r\n", &st);  
-  while (line) {
-#define WHITE " \t"
-    char * ist;
-    char * start = strtok_r(line, WHITE, &ist);
-    char * type = strtok_r(NULL, WHITE, &ist);
-    char * name = strtok_r(NULL, WHITE ";", &ist); 
-    char * comm = strtok_r(NULL, WHITE, &ist);
-    char * eq = strtok_r(NULL, WHITE, &ist);
-    char * val = strtok_r(NULL, WHITE ";", &ist);
-    (void)comm;
-    (void)start;
-    av_log(ctx, AV_LOG_DEBUG, "start %s type %s name %s comm %s eq %s val %s\n", start, type, name, comm, eq, val);
-    if (streq(start, "uniform") && val) {
-      GLint loc;
-      loc = glGetUniformLocation(c->program, name);
-      if (loc < 0)
-	  av_log(ctx, AV_LOG_ERROR, "no uniform named %s\n", name);
-      else if (streq(type, "bool")) {
-	if (av_match_name(val, "true,1"))
-	  glUniform1i(loc, 1);
-	else if (av_match_name(val, "false,0"))
-	  glUniform1i(loc, 0);
-	else
-	  av_log(ctx, AV_LOG_ERROR, "parsing bool %s for uniform %s\n", val, name);
-      }
-      else if (streq(type, "int")) {
-	int v;
-	if (1 == sscanf(val, "%d", &v))
-	  glUniform1i(loc, v);
-	else
-	  av_log(ctx, AV_LOG_ERROR, "parsing integer %s for uniform %s\n", val, name);
-      }
-      else if (streq(type, "float")) {
-	float v;
-	if (1 == sscanf(val, "%f", &v))
-	  glUniform1f(loc, v);
-	else
-	  av_log(ctx, AV_LOG_ERROR, "parsing float %s for uniform %s\n", val, name);
-      }
-      else if (streq(type, "ivec2")) {
-	int x,y;
-	if (2 == sscanf(val, "ivec2(%d,%d)", &x, &y))
-	  glUniform2i(loc, x, x);
-	else if (1 == sscanf(val, "ivec2(%d)", &x))
-	  glUniform2i(loc, x, x);
-	else
-	  av_log(ctx, AV_LOG_ERROR, "parsing ivec2 %s for uniform %s\n", val, name);
-      }
-      else if (streq(type, "vec2")) {
-	float x,y;
-	if (2 == sscanf(val, "vec2(%f,%f)", &x, &y))
-	  glUniform2f(loc, x, x);
-	else if (1 == sscanf(val, "vec2(%f)", &x))
-	  glUniform2f(loc, x, x);
-	else
-	  av_log(ctx, AV_LOG_ERROR, "parsing vec2 %s for uniform %s\n", val, name);
-      }
-      else if (streq(type, "vec3")) {
-	float x,y,z;
-	if (3 == sscanf(val, "vec3(%f,%f,%f)", &x, &y, &z))
-	  glUniform3f(loc, x, y, z);
-	else if (1 == sscanf(val, "vec3(%f)", &x))
-	  glUniform3f(loc, x, x, x);
-	else
-	  av_log(ctx, AV_LOG_ERROR, "parsing vec3 %s for uniform %s\n", val, name);
-      }
-      else if (streq(type, "vec4")) {
-	float x,y,z,w;
-	if (4 == sscanf(val, "vec4(%f,%f,%f,%f)", &x, &y, &z, &w))
-	  glUniform4f(loc, x, y, z, w);
-	else if (1 == sscanf(val, "vec4(%f)", &x))
-	  glUniform4f(loc, x, x, x, x);
-	else
-	  av_log(ctx, AV_LOG_ERROR, "parsing vec4 %s for uniform %s\n", val, name);
-      }
-      else
-	av_log(ctx, AV_LOG_ERROR, "unrecognized type %s for uniform %s\n", type, name);
-    }
-    line = strtok_r(NULL, "\r\n", &st);
-  }
-  free(src);
-
-  glUniform1i(glGetUniformLocation(c->program, "from"), 0);
-  glUniform1i(glGetUniformLocation(c->program, "to"), 1);
-  
-  c->progress = glGetUniformLocation(c->program, "progress");
-  glUniform1f(c->progress, 0.0f);
-
-  glUniform1f(glGetUniformLocation(c->program, "ratio"), ratio);
+  return strcmp(name, entry);
+}
 
-  get_matrix(c->resize, mfrom, ratio, fromR);
-  glUniformMatrix3fv(glGetUniformLocation(c->program, "mfrom"), 1, GL_FALSE, mfrom);
-  get_matrix(c->resize, mto, ratio, toR);    
-  glUniformMatrix3fv(glGetUniformLocation(c->program, "mto"), 1, GL_FALSE, mto);  
+static int cmp_bundle_key(const void *key, const void *entry)
+{
+  return memcmp(key, entry, PROGRAM_KEY_SIZE);
 }
 
-static AVFrame *apply_transition(FFFrameSync *fs,
-                                 AVFilterContext *ctx,
-                                 AVFrame *fromFrame,
-                                 const AVFrame *toFrame)
+// Finds the source of a transition of a path like lib.gltb:crosswarp,
+// pointing into the mapping.
+static int bundle_source(AVFilterContext *ctx, const char *path, const char *suffix, const char **source)
 {
-  GLTransitionContext *c = ctx->priv;
-  AVFilterLink *fromLink = ctx->inputs[FROM];
-  AVFilterLink *toLink = ctx->inputs[TO];
-  AVFilterLink *outLink = ctx->outputs[0];
-  AVFrame *outFrame;
-  float ts;
-  float progress;
+  char *file = av_strndup(path, suffix - path + strlen(BUNDLE_SUFFIX) - 1);
+  const char *name = suffix + strlen(BUNDLE_SUFFIX);
+  const GLBundle *b;
+  const uint8_t *e;
+  int ret = file ? open_bundle(ctx, file, &b) : AVERROR(ENOMEM);
 
-  outFrame = ff_get_video_buffer(outLink, outLink->w, outLink->h);
-  if (!outFrame) {
-    return NULL;
+  av_free(file);
+  if (ret < 0) {
+    return ret;
   }
+  if (!(e = bsearch(name, b->data + BUNDLE_HEADER_SIZE, b->nb_sources, BUNDLE_SOURCE_SIZE, cmp_bundle_name))) {
+    av_log(ctx, AV_LOG_ERROR, "no transition named %s in the bundle\n", name);
+    return AVERROR(EINVAL);
+  }
+  *source = (const char *)b->data + AV_RL32(e + BUNDLE_NAME_SIZE);
+  return 0;
+}
 
-  av_frame_copy_props(outFrame, fromFrame);
+#ifndef __APPLE__
+static GLuint program_binary(const void *data, GLenum format, GLint size)
+{
+  GLuint program = glCreateProgram();
+  GLint status;
 
+  glProgramBinary(program, format, data, size);
+  glGetProgramiv(program, GL_LINK_STATUS, &status);
+  if (status != GL_TRUE) {
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+#endif
+
+// Creates a program from a binary linked earlier on the device, shipped in
+// one of the bundles or stored in cache_dir, returns 0 when there is none
+// the driver accepts.
+static GLuint load_program(AVFilterContext *ctx, const uint8_t *key)
+{
+#ifndef __APPLE__
+  GLTransitionContext *c = ctx->priv;
+  ProgramBinary *bin;
+  GLuint program = 0;
+  int i;
+
+  ff_mutex_lock(&device_lock);
+  for (bin = c->device->programs; bin && memcmp(bin->key, key, PROGRAM_KEY_SIZE); bin = bin->next);
+  // bundles are used in place, the binaries of the same driver version
+  // being under the same key
+  for (i = 0; !bin && !program && i < c->nb_bundles; i++) {
+    const GLBundle *b = c->bundles[i];
+    const uint8_t *e = bsearch(key, b->data + BUNDLE_HEADER_SIZE + b->nb_sources * BUNDLE_SOURCE_SIZE,
+                               b->nb_binaries, BUNDLE_BINARY_SIZE, cmp_bundle_key);
+    if (e && (program = program_binary(b->data + AV_RL32(e + PROGRAM_KEY_SIZE + 4),
+                                       AV_RL32(e + PROGRAM_KEY_SIZE), AV_RL32(e + PROGRAM_KEY_SIZE + 8)))) {
+      av_log(ctx, AV_LOG_VERBOSE, "program binary from %s\n", b->path);
+    }
+  }
+  if (!bin && !program && c->cache_dir && (bin = read_program_file(ctx, key))) {
+    bin->next = c->device->programs;
+    c->device->programs = bin;
+  }
+  if (bin && !(program = program_binary(bin->data, bin->format, bin->size))) {
+    // typically a driver update, the program gets compiled and stored again
+    av_log(ctx, AV_LOG_VERBOSE, "program binary rejected\n");
+  }
+  ff_mutex_unlock(&device_lock);
+  return program;
+#else
+  return 0;
+#endif
+}
+
+static void store_program(AVFilterContext *ctx, const uint8_t *key, GLuint program)
+{
+#ifndef __APPLE__
+  GLTransitionContext *c = ctx->priv;
+  ProgramBinary *bin;
+  GLint size = 0;
+  GLenum format;
+  uint8_t *data;
+
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+  if (size <= 0 || !(data = av_malloc(size))) {
+    return;
+  }
+  glGetProgramBinary(program, size, NULL, &format, data);
+
+  ff_mutex_lock(&device_lock);
+  for (bin = c->device->programs; bin && memcmp(bin->key, key, PROGRAM_KEY_SIZE); bin = bin->next);
+  if (!bin && (bin = av_mallocz(sizeof(*bin)))) {
+    memcpy(bin->key, key, PROGRAM_KEY_SIZE);
+    bin->next = c->device->programs;
+    c->device->programs = bin;
+  }
+  if (bin) {
+    av_free(bin->data);
+    bin->data = data;
+    bin->format = format;
+    bin->size = size;
+    if (c->cache_dir) {
+      write_program_file(ctx, bin);
+    }
+  } else {
+    av_free(data);
+  }
+  ff_mutex_unlock(&device_lock);
+#endif
+}
+
+static GLuint create_program(AVFilterContext *ctx, const GLchar *f_source)
+{
+  GLint status;
+  GLuint v_shader, f_shader, program;
+  uint8_t key[PROGRAM_KEY_SIZE];
+  int cached = program_binaries_supported() && program_key(f_source, key) >= 0;
+
+  if (cached && (program = load_program(ctx, key))) {
+    return program;
+  }
+
+  if (!(v_shader = build_shader(ctx, v_shader_source, GL_VERTEX_SHADER))) {
+    return 0;
+  }
+  if (!(f_shader = build_shader(ctx, f_source, GL_FRAGMENT_SHADER))) {
+    glDeleteShader(v_shader);
+    return 0;
+  }
+
+  program = glCreateProgram();
+  glAttachShader(program, v_shader);
+  glAttachShader(program, f_shader);
+  // every program shares the vertex buffer set up by create_vbo()
+  glBindAttribLocation(program, 0, "position");
+#ifndef __APPLE__
+  if (cached) {
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+#endif
+  glLinkProgram(program);
+  glDeleteShader(v_shader);
+  glDeleteShader(f_shader);
+
+  glGetProgramiv(program, GL_LINK_STATUS, &status);
+  if (status != GL_TRUE) {
+    char log[10000];
+    glGetProgramInfoLog(program, sizeof(log), NULL, log);
+    av_log(ctx, AV_LOG_ERROR, "invalid program: %s\n", log);
+    glDeleteProgram(program);
+    return 0;
+  }
+
+  if (cached) {
+    store_program(ctx, key, program);
+  }
+  return program;
+}
+
+static int streq(const char * s1, const char * s2) {
+  return s1 && s2 && !strcmp(s1,s2);
+}
+
+static const UniformType uniform_types[] = {
+  { "bool", 1, 1 },
+  { "int", 1, 1 },
+  { "ivec2", 1, 2 },
+  { "ivec3", 1, 3 },
+  { "ivec4", 1, 4 },
+  { "float", 0, 1 },
+  { "vec2", 0, 2 },
+  { "vec3", 0, 3 },
+  { "vec4", 0, 4 },
+};
+
+#define WHITE " \t"
+
+// Reads a value of the given type: a number, true or false, or a vector
+// constructor such as vec2(1.0, -1.0), a single component applying to all.
+static int parse_uniform_value(const UniformType *type, const char *str, UniformValue *v)
+{
+  const char *p = str + strspn(str, WHITE);
+  size_t len = strlen(type->name);
+  int paren = 0, n = 0, k;
+  char *end;
+
+  if (streq(type->name, "bool") && (!strncmp(p, "true", 4) || !strncmp(p, "false", 5))) {
+    v->i[0] = *p == 't';
+    p += v->i[0] ? 4 : 5;
+    n = 1;
+  } else {
+    if (!strncmp(p, type->name, len) && p[len] == '(') {
+      p += len;
+    }
+    if (*p == '(') {
+      p++;
+      paren = 1;
+    }
+    while (n < type->n) {
+      double d = strtod(p, &end);
+      if (end == p) {
+        break;
+      }
+      if (type->integer) {
+        v->i[n++] = lrint(d);
+      } else {
+        v->f[n++] = d;
+      }
+      p = end + strspn(end, WHITE);
+      if (*p != ',') {
+        break;
+      }
+      p++;
+    }
+    if (paren && *p++ != ')') {
+      return AVERROR(EINVAL);
+    }
+  }
+  p += strspn(p, WHITE ";");
+  if (*p || (n != 1 && n != type->n)) {
+    return AVERROR(EINVAL);
+  }
+  for (k = n; k < type->n; k++) {
+    v->i[k] = v->i[0];
+  }
+  return 0;
+}
+
+// Collects the uniforms declared one per line by the transition source.
+static int parse_uniforms(AVFilterContext *ctx, const char *src, UniformTable *t)
+{
+  const char *line, *eol;
+
+  for (line = src; *line; line = eol + !!*eol) {
+    const char *p = line + strspn(line, WHITE), *comment;
+    char type[16], name[64], value[256];
+    UniformDesc *u;
+    int n = 0, i;
+
+    eol = line + strcspn(line, "\r\n");
+    if (strncmp(p, "uniform", 7) || !strchr(WHITE, p[7]) ||
+        sscanf(p + 7, " %15[A-Za-z0-9_] %63[A-Za-z0-9_]%n", type, name, &n) < 2 || p + 7 + n > eol) {
+      continue;
+    }
+    for (i = 0; i < FF_ARRAY_ELEMS(uniform_types) && !streq(uniform_types[i].name, type); i++);
+    if (i == FF_ARRAY_ELEMS(uniform_types)) {
+      // samplers and whatever the filter does not know how to set
+      continue;
+    }
+
+    u = av_dynarray2_add((void **)&t->uniforms, &t->nb_uniforms, sizeof(*u), NULL);
+    if (!u) {
+      return AVERROR(ENOMEM);
+    }
+    memset(u, 0, sizeof(*u));
+    av_strlcpy(u->name, name, sizeof(u->name));
+    u->type = &uniform_types[i];
+
+    // gl-transitions give the default as "uniform float x; // = 1.0"
+    p += 7 + n;
+    comment = strstr(p, "//");
+    if (!comment || comment > eol) {
+      continue;
+    }
+    p = comment + 2 + strspn(comment + 2, WHITE);
+    if (*p != '=') {
+      continue;
+    }
+    p++;
+    av_strlcpy(value, p, FFMIN(sizeof(value), eol - p + 1));
+    if (parse_uniform_value(u->type, value, &u->def) < 0) {
+      av_log(ctx, AV_LOG_ERROR, "parsing %s %s for uniform %s\n", type, value, name);
+    } else {
+      u->hasDefault = 1;
+    }
+  }
+  return 0;
+}
+
+// Finds the uniform table of a transition source on the device, parsing it
+// the first time.
+static int get_uniform_table(AVFilterContext *ctx, const char *transition_source)
+{
+  GLTransitionContext *c = ctx->priv;
+  UniformTable *t;
+  uint8_t key[PROGRAM_KEY_SIZE];
+  int ret;
+
+  if ((ret = program_key(transition_source, key)) < 0) {
+    return ret;
+  }
+  ff_mutex_lock(&device_lock);
+  for (t = c->device->uniformTables; t && memcmp(t->key, key, PROGRAM_KEY_SIZE); t = t->next);
+  if (!t && (t = av_mallocz(sizeof(*t)))) {
+    memcpy(t->key, key, PROGRAM_KEY_SIZE);
+    if ((ret = parse_uniforms(ctx, transition_source, t)) < 0) {
+      av_free(t->uniforms);
+      av_freep(&t);
+    } else {
+      t->next = c->device->uniformTables;
+      c->device->uniformTables = t;
+    }
+  }
+  ff_mutex_unlock(&device_lock);
+
+  c->uniformTable = t;
+  return t ? 0 : ret < 0 ? ret : AVERROR(ENOMEM);
+}
+
+// Texture without storage, left bound to unit 0 for the caller.
+static GLuint create_empty_tex(void)
+{
+  GLuint t;
+  glGenTextures(1, &t);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, t);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  return t;
+}
+
+static GLuint create_tex(const PlaneFormat *pf, unsigned w, unsigned h) {
+  GLuint t = create_empty_tex();
+
+#ifndef __APPLE__
+  // immutable storage lets frames be streamed in with glTexSubImage2D
+  // without the driver ever reallocating the texture
+  if (GLEW_ARB_texture_storage) {
+    glTexStorage2D(GL_TEXTURE_2D, 1, pf->internalFormat, w, h);
+    return t;
+  }
+#endif
+  glTexImage2D(GL_TEXTURE_2D, 0, pf->internalFormat, w, h, 0, pf->format, pf->type, NULL);
+  return t;
+}
+
+// Finds the "// pass" lines splitting a multi-pass transition, where pass
+// sections start, each with the code before the first of them.
+static int split_passes(AVFilterContext *ctx, const char *src, const char **starts, int *lines, float *scales)
+{
+  const char *l = src;
+  int n = 0, line = 0;
+
+  for (; *l; line++) {
+    if (!strncmp(l, "// pass", 7) && (!l[7] || strchr(" \t\r\n", l[7]))) {
+      if (n == MAX_PASSES + 1) {
+        av_log(ctx, AV_LOG_ERROR, "more than %d passes\n", MAX_PASSES + 1);
+        return AVERROR(EINVAL);
+      }
+      scales[n] = 1.0f;
+      if (sscanf(l + 7, " scale=%f", &scales[n]) == 1 && (scales[n] <= 0.0f || scales[n] > 1.0f)) {
+        av_log(ctx, AV_LOG_ERROR, "invalid scale of pass %d\n", n);
+        return AVERROR(EINVAL);
+      }
+      starts[n] = l;
+      lines[n++] = line;
+    }
+    l += strcspn(l, "\n");
+    l += *l == '\n';
+  }
+  return n;
+}
+
+// Compiles one pass, declaring the samplers of the passes before it.
+static GLuint build_pass(AVFilterContext *ctx, const char *samplers, const char *common, int commonLen,
+                         const char *body, int bodyLen, int line, int pass)
+{
+  GLTransitionContext *c = ctx->priv;
+  char decls[MAX_PASSES * 32] = "";
+  char *header, *src;
+  int k;
+
+  for (k = 0; k < pass; k++) {
+    av_strlcatf(decls, sizeof(decls), "uniform sampler2D pass%d;\n", k);
+  }
+  // the template numbers the transition source from 1
+  header = av_asprintf("%s%s%s", samplers, f_pass_source, decls);
+  src = av_asprintf("%.*s\n#line %d 0\n%.*s", commonLen, common, line + 1, bodyLen, body);
+  av_freep(&c->f_shader_source);
+  if (header && src) {
+    c->f_shader_source = av_asprintf(f_shader_template, header, src);
+  }
+  av_free(header);
+  av_free(src);
+  if (!c->f_shader_source) {
+    return 0;
+  }
+  av_log(ctx, AV_LOG_DEBUG, "\n%s\n", c->f_shader_source);
+  return create_program(ctx, c->f_shader_source);
+}
+
+// Intermediate images are as precise as the output samples.
+static PlaneFormat intermediate_format(const GLTransitionContext *c)
+{
+  const PlaneFormat pf = {
+    c->fmt->planes[0].type == GL_UNSIGNED_SHORT ? GL_RGBA16 : GL_RGBA8, GL_RGBA, c->fmt->planes[0].type, 0, 0
+  };
+  return pf;
+}
+
+static int create_pass_target(AVFilterContext *ctx, TransitionPass *p)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  const PlaneFormat pf = intermediate_format(c);
+
+  p->w = FFMAX(lrintf(outLink->w * p->scale), 1);
+  p->h = FFMAX(lrintf(outLink->h * p->scale), 1);
+  p->tex = create_tex(&pf, p->w, p->h);
+  // filters reading around the edges don't fade them to black
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glGenFramebuffers(1, &p->fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, p->fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, p->tex, 0);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    av_log(ctx, AV_LOG_ERROR, "incomplete framebuffer for a pass\n");
+    return AVERROR_EXTERNAL;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  return 0;
+}
+
+// Creates the targets of the passes of every program, or deletes them.
+static int create_pass_targets(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  int i, j, ret;
+
+  for (i = 0; i < (c->transitions ? c->nb_transitions : 1); i++) {
+    TransitionPass *passes = c->transitions ? c->transitions[i].passes : c->passes;
+    int nb_passes = c->transitions ? c->transitions[i].nb_passes : c->nb_passes;
+    for (j = 0; j < nb_passes; j++) {
+      if ((ret = create_pass_target(ctx, &passes[j])) < 0) {
+        return ret;
+      }
+    }
+  }
+  return 0;
+}
+
+static void delete_pass_targets(GLTransitionContext *c)
+{
+  int i, j;
+
+  for (i = 0; i < (c->transitions ? c->nb_transitions : 1); i++) {
+    TransitionPass *passes = c->transitions ? c->transitions[i].passes : c->passes;
+    int nb_passes = c->transitions ? c->transitions[i].nb_passes : c->nb_passes;
+    for (j = 0; passes && j < nb_passes; j++) {
+      if (passes[j].fbo)
+        glDeleteFramebuffers(1, &passes[j].fbo);
+      if (passes[j].tex)
+        glDeleteTextures(1, &passes[j].tex);
+      passes[j].fbo = passes[j].tex = 0;
+    }
+  }
+}
+
+static void free_passes(TransitionPass **passes, int nb_passes)
+{
+  int i;
+  for (i = 0; *passes && i < nb_passes; i++) {
+    TransitionPass *p = &(*passes)[i];
+    if (p->program)
+      glDeleteProgram(p->program);
+    if (p->fbo)
+      glDeleteFramebuffers(1, &p->fbo);
+    if (p->tex)
+      glDeleteTextures(1, &p->tex);
+    av_freep(&p->uniformLocs);
+  }
+  av_freep(passes);
+}
+
+static int uses_previous(const TransitionPass *passes, int nb_passes, GLuint program)
+{
+  int i;
+  for (i = 0; i < nb_passes; i++) {
+    if (glGetUniformLocation(passes[i].program, "previous") >= 0)
+      return 1;
+  }
+  return glGetUniformLocation(program, "previous") >= 0;
+}
+
+// Keeps a copy of the last output, black before the first one, when some
+// transition samples it.
+static int create_previous_target(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  const PlaneFormat pf = intermediate_format(c);
+  int i, used = !c->transitions && uses_previous(c->passes, c->nb_passes, c->program);
+  GLuint fbo;
+
+  for (i = 0; i < c->nb_transitions && !used; i++) {
+    const TimelineTransition *t = &c->transitions[i];
+    used = uses_previous(t->passes, t->nb_passes, t->program);
+  }
+  if (!used) {
+    return 0;
+  }
+  c->prevTex = create_tex(&pf, outLink->w, outLink->h);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, c->prevTex, 0);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    av_log(ctx, AV_LOG_ERROR, "incomplete framebuffer for the previous output\n");
+    return AVERROR_EXTERNAL;
+  }
+  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+  glClear(GL_COLOR_BUFFER_BIT);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &fbo);
+
+  // the output is copied straight into it
+  glActiveTexture(GL_TEXTURE0 + PREVIOUS_UNIT);
+  glBindTexture(GL_TEXTURE_2D, c->prevTex);
+  return 0;
+}
+
+// Builds c->program, and c->passes before it for multi-pass transitions.
+static int build_program(AVFilterContext *ctx, const char *path)
+{
+  GLTransitionContext *c = ctx->priv;
+  char *source = NULL;
+  char *samplers = NULL;
+  const char * transition_source;
+  const char *suffix, *bundled = NULL;
+  const char *starts[MAX_PASSES + 2];
+  int lines[MAX_PASSES + 1];
+  float scales[MAX_PASSES + 1];
+  int n, i, ret;
+
+
+  if (path && (suffix = strstr(path, BUNDLE_SUFFIX))) {
+    if ((ret = bundle_source(ctx, path, suffix, &bundled)) < 0) {
+      return ret;
+    }
+  } else if (path) {
+    FILE *f = fopen(path, "rb");
+    unsigned long fsize;
+    
+    if (!f) {
+      av_log(ctx, AV_LOG_ERROR, "invalid transition source file \"%s\"\n", path);
+      return -1;
+    }
+
+    fseek(f, 0, SEEK_END);
+    fsize = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    source = malloc(fsize + 1);
+    fread(source, fsize, 1, f);
+    fclose(f);
+
+    source[fsize] = 0;
+  }
+
+  transition_source = source ? source : bundled ? bundled : f_default_transition_source;
+  if ((ret = get_uniform_table(ctx, transition_source)) < 0 ||
+      (ret = n = split_passes(ctx, transition_source, starts, lines, scales)) < 0) {
+    free(source);
+    return ret;
+  }
+
+  if (c->fmt->chroma && !(samplers = av_asprintf(f_yuv_sampler_template, c->fmt->chroma))) {
+    free(source);
+    return AVERROR(ENOMEM);
+  }
+
+  // a single pass is the whole source
+  if (!n) {
+    starts[0] = transition_source;
+    lines[0] = 0;
+    scales[0] = 1.0f;
+    n = 1;
+  }
+  starts[n] = transition_source + strlen(transition_source);
+  c->nb_passes = n - 1;
+  if (c->nb_passes && !(c->passes = av_calloc(c->nb_passes, sizeof(*c->passes)))) {
+    ret = AVERROR(ENOMEM);
+  }
+  for (i = 0; i < n && ret >= 0; i++) {
+    // the "// pass" line itself goes with the common code, as a comment
+    GLuint program = build_pass(ctx, samplers ? samplers : f_rgb_sampler_source,
+                                transition_source, starts[0] - transition_source,
+                                starts[i], starts[i + 1] - starts[i], lines[i], i);
+    if (!program) {
+      ret = -1;
+    } else if (i < c->nb_passes) {
+      c->passes[i].program = program;
+      c->passes[i].scale = scales[i];
+    } else {
+      c->program = program;
+    }
+  }
+
+  free(source);
+  av_free(samplers);
+  return ret;
+}
+
+static GLuint create_vbo(GLTransitionContext *c)
+{
+  GLint loc;
+  GLuint buf;
+  glGenBuffers(1, &buf);
+  glBindBuffer(GL_ARRAY_BUFFER, buf);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(position), position, GL_STATIC_DRAW);
+
+  loc = glGetAttribLocation(c->program, "position");
+  glEnableVertexAttribArray(loc);
+  glVertexAttribPointer(loc, 2, GL_FLOAT, GL_FALSE, 0, 0);
+  return buf;
+}
+
+static GLuint create_tex_array(const PlaneFormat *pf, int w, int h, int layers)
+{
+  GLuint t;
+  glGenTextures(1, &t);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, t);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+#ifndef __APPLE__
+  if (GLEW_ARB_texture_storage) {
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, pf->internalFormat, w, h, layers);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    return t;
+  }
+#endif
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, pf->internalFormat, w, h, layers, 0, pf->format, pf->type, NULL);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  return t;
+}
+
+// Points the output framebuffers at one layer of the planeTex arrays.
+static void attach_batch_layer(GLTransitionContext *c, int layer)
+{
+  static const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+  int p;
+
+  if (!c->fmt->chroma) {
+    glBindFramebuffer(GL_FRAMEBUFFER, c->outFbo);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, c->planeTex[0], 0, layer);
+  } else {
+    glBindFramebuffer(GL_FRAMEBUFFER, c->lumaFbo);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, c->planeTex[0], 0, layer);
+    glBindFramebuffer(GL_FRAMEBUFFER, c->chromaFbo);
+    for (p = 1; p < c->fmt->nb_planes; p++) {
+      glFramebufferTextureLayer(GL_FRAMEBUFFER, drawBuffers[p - 1], c->planeTex[p], 0, layer);
+    }
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Components of 8 or 16 bits can be averaged, packed 10 bit ones can't.
+static int sample_bytes(const PlaneFormat *pf)
+{
+  return pf->type == GL_UNSIGNED_SHORT ? 2 :
+    pf->type == GL_UNSIGNED_BYTE || pf->type == GL_UNSIGNED_INT_8_8_8_8_REV ? 1 : 0;
+}
+
+// log2 of the largest power of two a w x h input can be shrunk by and still
+// have as many pixels as the ow x oh area it is drawn to covers.
+static int prescale_shift(enum ResizeType resize, int w, int h, int ow, int oh)
+{
+  float dw = ow, dh = oh;
+  int k = 0;
+
+  if (resize != STRETCH) {
+    float contain = FFMIN(ow / (float)w, oh / (float)h);
+    float cover = FFMAX(ow / (float)w, oh / (float)h);
+    float s = resize == CONTAIN ? contain : cover;
+    dw = FFMIN(w * s, ow);
+    dh = FFMIN(h * s, oh);
+  }
+  while (k < 8 && (w >> (k + 1)) >= dw && (h >> (k + 1)) >= dh) {
+    k++;
+  }
+  return k;
+}
+
+// Averages the 2^k x 2^k blocks of a w x h plane of nc components of the
+// given bytes each, the blocks cut by the right and bottom edges included.
+static void shrink_plane(uint8_t *dst, int dstStride, const uint8_t *src, int srcStride,
+                         int w, int h, int nc, int bytes, int k)
+{
+  int dw = AV_CEIL_RSHIFT(w, k), dh = AV_CEIL_RSHIFT(h, k);
+  int x, y, i, j, n;
+
+  for (y = 0; y < dh; y++) {
+    int y0 = y << k, y1 = FFMIN(y0 + (1 << k), h);
+    for (x = 0; x < dw; x++) {
+      int x0 = x << k, x1 = FFMIN(x0 + (1 << k), w);
+      int count = (y1 - y0) * (x1 - x0);
+      for (n = 0; n < nc; n++) {
+        uint32_t sum = count / 2;
+        for (j = y0; j < y1; j++) {
+          const uint8_t *row = src + (size_t)j * srcStride;
+          for (i = x0; i < x1; i++) {
+            sum += bytes == 2 ? ((const uint16_t *)row)[i * nc + n] : row[i * nc + n];
+          }
+        }
+        if (bytes == 2) {
+          ((uint16_t *)(dst + (size_t)y * dstStride))[x * nc + n] = sum / count;
+        } else {
+          dst[(size_t)y * dstStride + x * nc + n] = sum / count;
+        }
+      }
+    }
+  }
+}
+
+// Copies a plane of an input frame into dst, shrunk when prescaling.
+static void copy_input_plane(GLTransitionContext *c, int input, const PlaneFormat *pf, uint8_t *dst, int dstStride,
+                             const AVFrame *frame, int p, int w, int h)
+{
+  int k = c->prescaleShift[input];
+  int bytes = sample_bytes(pf);
+
+  if (k) {
+    shrink_plane(dst, dstStride, frame->data[p], frame->linesize[p], w, h, pf->bpp / bytes, bytes, k);
+  } else {
+    av_image_copy_plane(dst, dstStride, frame->data[p], frame->linesize[p], w * pf->bpp, h);
+  }
+}
+
+static void upload_tex(GLuint tex, GLenum unit, const PlaneFormat *pf, unsigned w, unsigned h, GLint rowLength, const GLvoid *pixels)
+{
+  glActiveTexture(unit);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, rowLength);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, pf->format, pf->type, pixels);
+}
+
+// Whether the hardware frames are imported through DRM PRIME, which gives
+// the textures their storage on each frame.
+static int drm_frames(const GLTransitionContext *c)
+{
+#ifdef GL_TRANSITION_HWMAP_DRM
+# if CONFIG_VULKAN
+  if (c->hwFormat == AV_PIX_FMT_VULKAN) {
+    return 1;
+  }
+# endif
+  return c->hwFormat == AV_PIX_FMT_VAAPI;
+#else
+  return 0;
+#endif
+}
+
+static void create_frame_tex(GLTransitionContext *c, int input, int w, int h)
+{
+  int p;
+  for (p = 0; p < c->fmt->nb_planes; p++) {
+    const PlaneFormat *pf = &c->fmt->planes[p];
+    c->tex[input][p] = drm_frames(c) ? create_empty_tex() :
+      create_tex(pf, AV_CEIL_RSHIFT(w, pf->shift), AV_CEIL_RSHIFT(h, pf->shift));
+  }
+#ifndef __APPLE__
+  if (c->fmt->opaque && GLEW_ARB_texture_swizzle) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, GL_ONE);
+  }
+#endif
+}
+
+static void upload_frame(GLTransitionContext *c, int input, const AVFrame *frame, int w, int h)
+{
+  int k = c->prescaleShift[input];
+  uint8_t *buf = c->prescaleBuf[input];
+  int p;
+  for (p = 0; p < c->fmt->nb_planes; p++) {
+    const PlaneFormat *pf = &c->fmt->planes[p];
+    int pw = AV_CEIL_RSHIFT(w, pf->shift), ph = AV_CEIL_RSHIFT(h, pf->shift);
+    if (k) {
+      copy_input_plane(c, input, pf, buf, AV_CEIL_RSHIFT(pw, k) * pf->bpp, frame, p, pw, ph);
+      upload_tex(c->tex[input][p], GL_TEXTURE0 + TEX_UNIT(input, p), pf,
+                 AV_CEIL_RSHIFT(pw, k), AV_CEIL_RSHIFT(ph, k), 0, buf);
+      buf += (size_t)AV_CEIL_RSHIFT(pw, k) * AV_CEIL_RSHIFT(ph, k) * pf->bpp;
+    } else {
+      upload_tex(c->tex[input][p], GL_TEXTURE0 + TEX_UNIT(input, p), pf, pw, ph,
+                 frame->linesize[p] / pf->bpp, frame->data[p]);
+    }
+  }
+}
+
+// Whether the texture of an input already holds the pixels of a frame,
+// which is the case when it comes from the same buffer, or for static
+// inputs, once anything was uploaded.
+static int is_uploaded(GLTransitionContext *c, int input, const AVFrame *frame)
+{
+  const AVFrame *last = c->uploaded[input];
+  int p;
+
+  if (!last) {
+    return 0;
+  }
+  if (input == FROM ? c->static_from : c->static_to) {
+    return 1;
+  }
+  if (!frame->buf[0] || last->buf[0]->buffer != frame->buf[0]->buffer) {
+    return 0;
+  }
+  for (p = 0; p < c->fmt->nb_planes; p++) {
+    if (last->data[p] != frame->data[p] || last->linesize[p] != frame->linesize[p]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Holding the reference keeps the buffer from being reused for other pixels.
+static void set_uploaded(GLTransitionContext *c, int input, const AVFrame *frame)
+{
+  av_frame_free(&c->uploaded[input]);
+  if (frame->buf[0]) {
+    c->uploaded[input] = av_frame_clone(frame);
+  }
+}
+
+static void wait_fence(GLsync *fence)
+{
+  if (*fence) {
+    while (glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(*fence);
+    *fence = NULL;
+  }
+}
+
+static void make_current(GLTransitionContext *c)
+{
+#ifdef GL_TRANSITION_USING_EGL
+  eglMakeCurrent(c->eglDpy, c->eglSurf, c->eglSurf, c->eglCtx);
+#else
+  glfwMakeContextCurrent(c->window);
+#endif
+}
+
+static void release_current(GLTransitionContext *c)
+{
+#ifdef GL_TRANSITION_USING_EGL
+  eglMakeCurrent(c->eglDpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+#else
+  glfwMakeContextCurrent(NULL);
+#endif
+}
+
+// Whether config_gl() got as far as the context of the instance, the
+// device is taken by query_formats() already.
+static int has_context(GLTransitionContext *c)
+{
+#ifdef GL_TRANSITION_USING_EGL
+  return c->eglCtx != EGL_NO_CONTEXT;
+#else
+  return c->window != NULL;
+#endif
+}
+
+static unsigned ring_count(RenderRing *r)
+{
+  return atomic_load_explicit(&r->tail, memory_order_acquire) -
+         atomic_load_explicit(&r->head, memory_order_acquire);
+}
+
+// Called by the producer of the ring only, fails when it is full.
+static int ring_push(RenderRing *r, const RenderJob *job)
+{
+  unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+  if (tail - atomic_load_explicit(&r->head, memory_order_acquire) == r->size) {
+    return 0;
+  }
+  r->slots[tail & (r->size - 1)] = *job;
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  return 1;
+}
+
+// Called by the consumer of the ring only, fails when it is empty.
+static int ring_pop(RenderRing *r, RenderJob *job)
+{
+  unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+  if (atomic_load_explicit(&r->tail, memory_order_acquire) == head) {
+    return 0;
+  }
+  *job = r->slots[head & (r->size - 1)];
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  return 1;
+}
+
+static int ring_init(RenderRing *r, unsigned size)
+{
+  for (r->size = 1; r->size < size; r->size <<= 1);
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+  return (r->slots = av_calloc(r->size, sizeof(*r->slots))) ? 0 : AVERROR(ENOMEM);
+}
+
+// Tells the other side that this one is about to sleep on renderCond, under
+// renderLock and before checking what it waits for. The fence orders the
+// flag before those checks, as the one in wake_peer() orders a change before
+// the flag is read, so either the change is seen or the flag is.
+static void prepare_sleep(atomic_int *sleeping)
+{
+  atomic_store_explicit(sleeping, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+static void wake_peer(GLTransitionContext *c, atomic_int *sleeping)
+{
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(sleeping, memory_order_relaxed)) {
+    ff_mutex_lock(&c->renderLock);
+    ff_cond_broadcast(&c->renderCond);
+    ff_mutex_unlock(&c->renderLock);
+  }
+}
+
+// Sends a rendered frame downstream, or back to activate() when rendering
+// on the render thread.
+static int emit_frame(AVFilterContext *ctx, AVFrame *frame)
+{
+  GLTransitionContext *c = ctx->priv;
+  RenderJob out = { frame };
+
+  if (!c->renderRunning) {
+    return ff_filter_frame(ctx->outputs[0], frame);
+  }
+  // activate() doesn't have more frames with the thread than the ring holds
+  if (!ring_push(&c->done, &out)) {
+    av_frame_free(&frame);
+    return AVERROR_BUG;
+  }
+  wake_peer(c, &c->graphSleeping);
+  return 0;
+}
+
+#ifdef GL_TRANSITION_USING_EGL
+// Lists the GPUs through EGL_EXT_device_enumeration, returns how many.
+static int query_egl_devices(EGLDeviceEXT *devs)
+{
+  const char *exts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  PFNEGLQUERYDEVICESEXTPROC queryDevices;
+  EGLint n;
+
+  if (!exts || !strstr(exts, "EGL_EXT_device_enumeration") || !strstr(exts, "EGL_EXT_platform_device")) {
+    return 0;
+  }
+  queryDevices = (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+  if (!queryDevices || !queryDevices(MAX_EGL_DEVICES, devs, &n)) {
+    return 0;
+  }
+  return n;
+}
+
+// Whether a device is the one behind a /dev/dri card or render node.
+static int egl_device_has_node(EGLDeviceEXT dev, const char *node)
+{
+  PFNEGLQUERYDEVICESTRINGEXTPROC queryString =
+    (PFNEGLQUERYDEVICESTRINGEXTPROC)eglGetProcAddress("eglQueryDeviceStringEXT");
+  const char *exts;
+
+  if (!queryString || !(exts = queryString(dev, EGL_EXTENSIONS))) {
+    return 0;
+  }
+  if (strstr(exts, "EGL_EXT_device_drm") && streq(queryString(dev, EGL_DRM_DEVICE_FILE_EXT), node)) {
+    return 1;
+  }
+#ifdef EGL_DRM_RENDER_NODE_FILE_EXT
+  if (strstr(exts, "EGL_EXT_device_drm_render_node") && streq(queryString(dev, EGL_DRM_RENDER_NODE_FILE_EXT), node)) {
+    return 1;
+  }
+#endif
+  return 0;
+}
+
+static EGLDisplay get_device_display(AVFilterContext *ctx, int index)
+{
+  EGLDeviceEXT devs[MAX_EGL_DEVICES];
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+    (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+  int n = query_egl_devices(devs);
+
+  if (index >= n || !getPlatformDisplay) {
+    av_log(ctx, AV_LOG_ERROR, "EGL device %d not found, %d available\n", index, n);
+    return EGL_NO_DISPLAY;
+  }
+  return getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, devs[index], NULL);
+}
+#endif
+
+// Turns the device option into the key of the pool entry to use: "default"
+// for the default display, otherwise the index of an EGL device. auto picks
+// the device with the fewest instances of this process, starting the search
+// at an offset moving with the process id and with each pick, so that both
+// the instances of a process and concurrent processes spread over the GPUs.
+// Called with device_lock held.
+static int device_key(AVFilterContext *ctx, const char *name, char *key, size_t size)
+{
+#ifdef GL_TRANSITION_USING_EGL
+  static unsigned auto_picks;
+  EGLDeviceEXT devs[MAX_EGL_DEVICES];
+  GLDevice *dev;
+  char *end;
+  int n, i, k, index = -1, load, best = INT_MAX;
+
+  if (!name || streq(name, "default")) {
+    av_strlcpy(key, "default", size);
+    return 0;
+  }
+
+  n = query_egl_devices(devs);
+  if (streq(name, "auto")) {
+    if (!n) {
+      av_log(ctx, AV_LOG_WARNING, "EGL devices can't be enumerated, using the default display\n");
+      av_strlcpy(key, "default", size);
+      return 0;
+    }
+    for (k = 0; k < n; k++) {
+      i = (getpid() + auto_picks + k) % n;
+      snprintf(key, size, "%d", i);
+      load = 0;
+      for (dev = devices; dev; dev = dev->next) {
+        if (streq(dev->key, key)) {
+          load = dev->refcount;
+        }
+      }
+      if (load < best) {
+        best = load;
+        index = i;
+      }
+    }
+    auto_picks++;
+  } else if (name[0] == '/') {
+    for (i = 0; i < n && index < 0; i++) {
+      if (egl_device_has_node(devs[i], name)) {
+        index = i;
+      }
+    }
+  } else {
+    index = strtol(name, &end, 10);
+    if (*end || index < 0) {
+      index = -1;
+    }
+  }
+  if (index < 0 || index >= n) {
+    av_log(ctx, AV_LOG_ERROR, "EGL device %s not found, %d available\n", name, n);
+    return AVERROR(EINVAL);
+  }
+  av_log(ctx, AV_LOG_VERBOSE, "rendering on EGL device %d of %d\n", index, n);
+  snprintf(key, size, "%d", index);
+#else
+  if (name) {
+    av_log(ctx, AV_LOG_WARNING, "device is only supported with EGL\n");
+  }
+  av_strlcpy(key, "default", size);
+#endif
+  return 0;
+}
+
+static GLDevice *open_device(AVFilterContext *ctx, const char *key)
+{
+  GLDevice *dev = av_mallocz(sizeof(*dev));
+#ifdef GL_TRANSITION_USING_EGL
+  EGLint major, minor, numConfigs;
+  const char *exts;
+#endif
+
+  if (!dev) {
+    return NULL;
+  }
+
+#ifdef GL_TRANSITION_USING_EGL
+  dev->dpy = streq(key, "default") ? eglGetDisplay(EGL_DEFAULT_DISPLAY) : get_device_display(ctx, atoi(key));
+  if (dev->dpy == EGL_NO_DISPLAY || !eglInitialize(dev->dpy, &major, &minor)) {
+    av_log(ctx, AV_LOG_ERROR, "initializing EGL display failed\n");
+    av_free(dev);
+    return NULL;
+  }
+  av_log(ctx, AV_LOG_DEBUG, "EGL %d.%d\n", major, minor);
+  exts = eglQueryString(dev->dpy, EGL_EXTENSIONS);
+  dev->surfaceless = exts && strstr(exts, "EGL_KHR_surfaceless_context");
+
+  eglBindAPI(EGL_OPENGL_API);
+  if (!eglChooseConfig(dev->dpy, dev->surfaceless ? surfacelessAttribs : configAttribs, &dev->cfg, 1, &numConfigs) ||
+      numConfigs < 1 ||
+      (dev->ctx = eglCreateContext(dev->dpy, dev->cfg, EGL_NO_CONTEXT, NULL)) == EGL_NO_CONTEXT) {
+    av_log(ctx, AV_LOG_ERROR, "creating EGL context failed\n");
+    eglTerminate(dev->dpy);
+    av_free(dev);
+    return NULL;
+  }
+  if (!dev->surfaceless &&
+      (dev->surf = eglCreatePbufferSurface(dev->dpy, dev->cfg, pbufferAttribs)) == EGL_NO_SURFACE) {
+    av_log(ctx, AV_LOG_ERROR, "creating EGL surface failed\n");
+    eglDestroyContext(dev->dpy, dev->ctx);
+    eglTerminate(dev->dpy);
+    av_free(dev);
+    return NULL;
+  }
+#else
+  if (!glfwInit()) {
+    av_free(dev);
+    return NULL;
+  }
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  if (!(dev->window = glfwCreateWindow(1, 1, "", NULL, NULL))) {
+    av_log(ctx, AV_LOG_ERROR, "setup_gl ERROR\n");
+    av_free(dev);
+    return NULL;
+  }
+#endif
+  return dev;
+}
+
+static void close_device(GLDevice *dev)
+{
+  while (dev->programs) {
+    ProgramBinary *bin = dev->programs;
+    dev->programs = bin->next;
+    av_free(bin->data);
+    av_free(bin);
+  }
+  while (dev->uniformTables) {
+    UniformTable *t = dev->uniformTables;
+    dev->uniformTables = t->next;
+    av_free(t->uniforms);
+    av_free(t);
+  }
+#ifdef GL_TRANSITION_USING_EGL
+  if (dev->surf) {
+    eglDestroySurface(dev->dpy, dev->surf);
+  }
+  eglDestroyContext(dev->dpy, dev->ctx);
+  eglTerminate(dev->dpy);
+#else
+  glfwDestroyWindow(dev->window);
+#endif
+  av_free(dev->key);
+  av_free(dev);
+}
+
+// Takes a reference to the device the device option names, opening it on
+// first use. EGL hands out one display per device and process anyway, so it
+// is always shared and only the context group is up to the instance.
+static int acquire_device(AVFilterContext *ctx, const char *name)
+{
+  GLTransitionContext *c = ctx->priv;
+  GLDevice *dev;
+  char key[16];
+  int ret;
+
+  ff_mutex_lock(&device_lock);
+  if ((ret = device_key(ctx, name, key, sizeof(key))) < 0) {
+    ff_mutex_unlock(&device_lock);
+    return ret;
+  }
+  for (dev = devices; dev; dev = dev->next) {
+    if (streq(dev->key, key)) {
+      break;
+    }
+  }
+  if (!dev && (dev = open_device(ctx, key))) {
+    if (!(dev->key = av_strdup(key))) {
+      close_device(dev);
+      ff_mutex_unlock(&device_lock);
+      return AVERROR(ENOMEM);
+    }
+    dev->next = devices;
+    devices = dev;
+  }
+  if (dev) {
+    dev->refcount++;
+  }
+  ff_mutex_unlock(&device_lock);
+
+  c->device = dev;
+  return dev ? 0 : AVERROR_EXTERNAL;
+}
+
+static void release_device(GLDevice **pdev)
+{
+  GLDevice *dev = *pdev, **p;
+
+  if (!dev) {
+    return;
+  }
+  ff_mutex_lock(&device_lock);
+  if (!--dev->refcount) {
+    for (p = &devices; *p; p = &(*p)->next) {
+      if (*p == dev) {
+        *p = dev->next;
+        break;
+      }
+    }
+    close_device(dev);
+  }
+  ff_mutex_unlock(&device_lock);
+  *pdev = NULL;
+}
+
+static void delete_pool_buffer(OutputPool *op)
+{
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, op->buf);
+  glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  glDeleteBuffers(1, &op->buf);
+}
+
+// What was current on a thread before the root context of a device.
+typedef struct {
+#ifdef GL_TRANSITION_USING_EGL
+  EGLenum api;
+  EGLDisplay dpy;
+  EGLContext ctx;
+  EGLSurface draw, read;
+#else
+  GLFWwindow *window;
+#endif
+} SavedContext;
+
+// Makes the root context of a device current, holding device_lock until
+// restore_context(): nothing else makes it current, so that keeps it on one
+// thread at a time.
+static int make_root_current(GLDevice *dev, SavedContext *saved)
+{
+  ff_mutex_lock(&device_lock);
+#ifdef GL_TRANSITION_USING_EGL
+  saved->api = eglQueryAPI();
+  eglBindAPI(EGL_OPENGL_API);
+  saved->dpy = eglGetCurrentDisplay();
+  saved->ctx = eglGetCurrentContext();
+  saved->draw = eglGetCurrentSurface(EGL_DRAW);
+  saved->read = eglGetCurrentSurface(EGL_READ);
+  if (!eglMakeCurrent(dev->dpy, dev->surf, dev->surf, dev->ctx)) {
+    eglBindAPI(saved->api);
+    ff_mutex_unlock(&device_lock);
+    return AVERROR_EXTERNAL;
+  }
+#else
+  saved->window = glfwGetCurrentContext();
+  glfwMakeContextCurrent(dev->window);
+#endif
+  return 0;
+}
+
+static void restore_context(GLDevice *dev, const SavedContext *saved)
+{
+#ifdef GL_TRANSITION_USING_EGL
+  if (saved->ctx != EGL_NO_CONTEXT) {
+    eglMakeCurrent(saved->dpy, saved->draw, saved->read, saved->ctx);
+  } else {
+    eglMakeCurrent(dev->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  }
+  eglBindAPI(saved->api);
+#else
+  glfwMakeContextCurrent(saved->window);
+#endif
+  ff_mutex_unlock(&device_lock);
+}
+
+// Deletes the buffer of a pool whose instance is gone on the thread that
+// freed the last frame, restoring the context it had current.
+static void delete_orphaned_pool_buffer(OutputPool *op)
+{
+  SavedContext saved;
+
+  if (make_root_current(op->device, &saved) >= 0) {
+    delete_pool_buffer(op);
+    restore_context(op->device, &saved);
+  }
+}
+
+// current is set when uninit drops the last reference, with the context
+// of the instance current.
+static void unref_output_pool(OutputPool *op, int current)
+{
+  if (atomic_fetch_sub(&op->refs, 1) == 1) {
+    if (current) {
+      delete_pool_buffer(op);
+    } else {
+      delete_orphaned_pool_buffer(op);
+    }
+    release_device(&op->device);
+    av_free(op);
+  }
+}
+
+static void free_output_slot(void *opaque, uint8_t *data)
+{
+}
+
+static AVBufferRef *alloc_output_slot(void *opaque, int size)
+{
+  OutputPool *op = opaque;
+  // once every slot is held, frames are allocated normally
+  if (op->allocated == op->nb_slots) {
+    return NULL;
+  }
+  return av_buffer_create(op->ptr + op->allocated++ * op->slotSize, size, free_output_slot, op, 0);
+}
+
+static void output_pool_drained(void *opaque)
+{
+  OutputPool *op = opaque;
+  unref_output_pool(op, 0);
+}
+
+// Frames are writable downstream like any other, so the mapping is too.
+static int create_output_pool(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+#ifndef __APPLE__
+  GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  OutputPool *op;
+
+  if (!(op = av_mallocz(sizeof(*op)))) {
+    return AVERROR(ENOMEM);
+  }
+  op->slotSize = c->packSize;
+  op->nb_slots = FFMAX(c->output_pool, c->readback_depth);
+  atomic_init(&op->refs, 1);
+
+  glGenBuffers(1, &op->buf);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, op->buf);
+  // read by the CPU, so kept in cached client memory where the driver can
+  glBufferStorage(GL_PIXEL_PACK_BUFFER, op->slotSize * op->nb_slots, NULL, flags | GL_CLIENT_STORAGE_BIT);
+  op->ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, op->slotSize * op->nb_slots, flags);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  if (!op->ptr) {
+    glDeleteBuffers(1, &op->buf);
+    av_free(op);
+    av_log(ctx, AV_LOG_ERROR, "mapping the output pool failed\n");
+    return AVERROR_EXTERNAL;
+  }
+  if (!(op->pool = av_buffer_pool_init2(op->slotSize, op, alloc_output_slot, output_pool_drained))) {
+    delete_pool_buffer(op);
+    av_free(op);
+    return AVERROR(ENOMEM);
+  }
+  ff_mutex_lock(&device_lock);
+  c->device->refcount++;
+  ff_mutex_unlock(&device_lock);
+  op->device = c->device;
+  atomic_fetch_add(&op->refs, 1);
+  c->outPool = op;
+  return 0;
+#else
+  return AVERROR(ENOSYS);
+#endif
+}
+
+static void destroy_output_pool(GLTransitionContext *c)
+{
+  OutputPool *op = c->outPool;
+  int i;
+
+  if (c->packFences) {
+    for (i = 0; i < c->readback_depth; i++)
+      if (c->packFences[i])
+        glDeleteSync(c->packFences[i]);
+  }
+  av_freep(&c->packFences);
+  if (!op) {
+    return;
+  }
+  // frames still downstream keep the mapping, and the device, alive
+  av_buffer_pool_uninit(&op->pool);
+  unref_output_pool(op, 1);
+  c->outPool = NULL;
+}
+
+// The output planes are laid out one after the other, the ones frames
+// refer to with rows padded to 32 pixels like read_batch().
+static int create_pack_buffers(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  int padded = c->computeProgram || c->output_pool;
+  int i, p, ret;
+
+  c->packFrames = av_calloc(c->readback_depth, sizeof(*c->packFrames));
+  if (!c->packFrames) {
+    return AVERROR(ENOMEM);
+  }
+  // max_inflight: frames go out as soon as the fence after their readback
+  // has signaled, instead of once the ring is full
+  if ((c->output_pool || (c->max_inflight && GLEW_ARB_sync)) &&
+      !(c->packFences = av_calloc(c->readback_depth, sizeof(*c->packFences)))) {
+    return AVERROR(ENOMEM);
+  }
+
+  for (p = 0; p < c->fmt->nb_planes; p++) {
+    const PlaneFormat *pf = &c->fmt->planes[p];
+    int w = AV_CEIL_RSHIFT(outLink->w, pf->shift);
+    c->packLinesizes[p] = (padded ? FFALIGN(w, 32) : w) * pf->bpp;
+    c->packOffsets[p] = c->packSize;
+    c->packSize += FFALIGN(c->packLinesizes[p] * AV_CEIL_RSHIFT(outLink->h, pf->shift), 256);
+  }
+  if (c->output_pool && (ret = create_output_pool(ctx)) != AVERROR(ENOSYS)) {
+    return ret;
+  }
+
+  if (!(c->packBufs = av_calloc(c->readback_depth, sizeof(*c->packBufs)))) {
+    return AVERROR(ENOMEM);
+  }
+  glGenBuffers(c->readback_depth, c->packBufs);
+  for (i = 0; i < c->readback_depth; i++) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, c->packBufs[i]);
+    glBufferData(GL_PIXEL_PACK_BUFFER, c->packSize, NULL, GL_STREAM_READ);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  if (c->computeProgram && !(c->packPool = av_buffer_pool_init(c->packSize, NULL))) {
+    return AVERROR(ENOMEM);
+  }
+  return 0;
+}
+
+static int create_batch_queue(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  size_t size = 0;
+  int p;
+
+  c->batchFrom = av_calloc(c->batch, sizeof(*c->batchFrom));
+  c->batchTo = av_calloc(c->batch, sizeof(*c->batchTo));
+  c->batchOut = av_calloc(c->batch, sizeof(*c->batchOut));
+  c->batchProgress = av_calloc(c->batch, sizeof(*c->batchProgress));
+  c->batchSeq = av_calloc(c->batch, sizeof(*c->batchSeq));
+  if (!c->batchFrom || !c->batchTo || !c->batchOut || !c->batchProgress || !c->batchSeq) {
+    return AVERROR(ENOMEM);
+  }
+
+  for (p = 0; p < c->fmt->nb_planes; p++) {
+    const PlaneFormat *pf = &c->fmt->planes[p];
+    // rows padded to 32 pixels keep every line aligned for SIMD consumers
+    c->batchLinesizes[p] = FFALIGN(AV_CEIL_RSHIFT(outLink->w, pf->shift), 32) * pf->bpp;
+    c->batchLayerSize[p] = (size_t)c->batchLinesizes[p] * AV_CEIL_RSHIFT(outLink->h, pf->shift);
+    size += c->batchLayerSize[p] * c->batch;
+  }
+  if (!(c->batchPool = av_buffer_pool_init(size, NULL))) {
+    return AVERROR(ENOMEM);
+  }
+  return 0;
+}
+
+// Renders RGB output into a texture of our own rather than the default
+// framebuffer, so the surface never has to match the output size or format.
+static int create_rgb_target(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  PlaneFormat target = c->fmt->planes[0];
+  const PlaneFormat *pf = &target;
+
+  // RGB8 and RGB16 aren't required to be color-renderable, their RGBA
+  // counterparts are and keep the same precision
+  if (target.internalFormat == GL_RGB8) {
+    target.internalFormat = GL_RGBA8;
+  } else if (target.internalFormat == GL_RGB16) {
+    target.internalFormat = GL_RGBA16;
+  }
+
+  glGenFramebuffers(1, &c->outFbo);
+  if (c->batch > 1) {
+    c->planeTex[0] = create_tex_array(pf, outLink->w, outLink->h, c->batch);
+    attach_batch_layer(c, 0);
+  } else {
+    c->planeTex[0] = create_tex(pf, outLink->w, outLink->h);
+    glBindFramebuffer(GL_FRAMEBUFFER, c->outFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, c->planeTex[0], 0);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, c->outFbo);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    av_log(ctx, AV_LOG_ERROR, "incomplete framebuffer for %s output\n", av_get_pix_fmt_name(c->fmt->pix_fmt));
+    return AVERROR_EXTERNAL;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  return 0;
+}
+
+static int create_upload_ring(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+#ifndef __APPLE__
+  AVFilterLink *fromLink = ctx->inputs[FROM];
+  AVFilterLink *toLink = ctx->inputs[TO];
+  GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  size_t size;
+  int input, p;
+
+  if (GLEW_ARB_buffer_storage && GLEW_ARB_texture_storage && GLEW_ARB_sync) {
+    c->uploadFences = av_calloc(c->upload_depth, sizeof(*c->uploadFences));
+    if (!c->uploadFences) {
+      return AVERROR(ENOMEM);
+    }
+
+    for (input = FROM; input <= TO; input++) {
+      AVFilterLink *inLink = input == FROM ? fromLink : toLink;
+      for (p = 0; p < c->fmt->nb_planes; p++) {
+        const PlaneFormat *pf = &c->fmt->planes[p];
+        c->uploadOffsets[input][p] = c->uploadSlotSize;
+        int k = c->prescaleShift[input];
+        c->uploadSlotSize += FFALIGN(AV_CEIL_RSHIFT(inLink->w, pf->shift + k) * pf->bpp *
+                                     AV_CEIL_RSHIFT(inLink->h, pf->shift + k), 256);
+      }
+    }
+    size = c->uploadSlotSize * c->upload_depth;
+
+    glGenBuffers(1, &c->uploadBuf);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, c->uploadBuf);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+    c->uploadPtr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (!c->uploadPtr) {
+      av_log(ctx, AV_LOG_ERROR, "mapping pixel unpack buffer failed\n");
+      return AVERROR_EXTERNAL;
+    }
+    return 0;
+  }
+#endif
+  av_log(ctx, AV_LOG_WARNING, "persistent buffer mapping not supported, uploading synchronously\n");
+  c->upload_depth = 1;
+  return 0;
+}
+
+// Copies both frames into the next ring slot once the GPU is done with it
+// and streams them into the textures from there, a NULL frame leaves its
+// texture untouched.
+static void stream_upload(AVFilterContext *ctx, const AVFrame *fromFrame, const AVFrame *toFrame)
+{
+  GLTransitionContext *c = ctx->priv;
+  const AVFrame *frames[2] = { fromFrame, toFrame };
+  int input, p;
+
+  wait_fence(&c->uploadFences[c->uploadHead]);
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, c->uploadBuf);
+  for (input = FROM; input <= TO; input++) {
+    AVFilterLink *inLink = ctx->inputs[input];
+    if (!frames[input]) {
+      continue;
+    }
+    for (p = 0; p < c->fmt->nb_planes; p++) {
+      const PlaneFormat *pf = &c->fmt->planes[p];
+      size_t offset = c->uploadHead * c->uploadSlotSize + c->uploadOffsets[input][p];
+      int k = c->prescaleShift[input];
+      int w = AV_CEIL_RSHIFT(inLink->w, pf->shift);
+      int h = AV_CEIL_RSHIFT(inLink->h, pf->shift);
+
+      copy_input_plane(c, input, pf, c->uploadPtr + offset, AV_CEIL_RSHIFT(w, k) * pf->bpp, frames[input], p, w, h);
+      upload_tex(c->tex[input][p], GL_TEXTURE0 + TEX_UNIT(input, p), pf,
+                 AV_CEIL_RSHIFT(w, k), AV_CEIL_RSHIFT(h, k), 0, (const GLvoid *)offset);
+    }
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+// Reads the planes the compute pass packed into buf with one transfer into
+// a pooled buffer, which the frame then refers to instead of a copy.
+static int read_packed(AVFilterContext *ctx, AVFrame *frame, GLuint buf)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVBufferRef *ref = av_buffer_pool_get(c->packPool);
+  int p;
+
+  if (!ref) {
+    return AVERROR(ENOMEM);
+  }
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glBindBuffer(GL_COPY_READ_BUFFER, buf);
+  glGetBufferSubData(GL_COPY_READ_BUFFER, 0, c->packSize, ref->data);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+  av_buffer_unref(&frame->buf[0]);
+  frame->buf[0] = ref;
+  for (p = 0; p < c->fmt->nb_planes; p++) {
+    frame->data[p] = ref->data + c->packOffsets[p];
+    frame->linesize[p] = c->packLinesizes[p];
+  }
+  return 0;
+}
+
+// Maps the oldest pack buffer, copies its pixels into the frame waiting on it
+// and sends that frame downstream.
+static int emit_oldest_readback(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  int slot = (c->packHead - c->packQueued + c->readback_depth) % c->readback_depth;
+  AVFrame *outFrame = c->packFrames[slot];
+  const uint8_t *pixels;
+  int p;
+
+  c->packFrames[slot] = NULL;
+  c->packQueued--;
+
+  if (c->packFences) {
+    wait_fence(&c->packFences[slot]);
+  }
+  if (c->outPool) {
+    return emit_frame(ctx, outFrame);
+  }
+  if (c->computeProgram) {
+    int ret = read_packed(ctx, outFrame, c->packBufs[slot]);
+    if (ret < 0) {
+      av_frame_free(&outFrame);
+      return ret;
+    }
+    return emit_frame(ctx, outFrame);
+  }
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, c->packBufs[slot]);
+  pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+  if (!pixels) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    av_frame_free(&outFrame);
+    av_log(ctx, AV_LOG_ERROR, "mapping pixel pack buffer failed\n");
+    return AVERROR_EXTERNAL;
+  }
+  for (p = 0; p < c->fmt->nb_planes; p++) {
+    const PlaneFormat *pf = &c->fmt->planes[p];
+    av_image_copy_plane(outFrame->data[p], outFrame->linesize[p], pixels + c->packOffsets[p],
+                        c->packLinesizes[p], c->packLinesizes[p], AV_CEIL_RSHIFT(outLink->h, pf->shift));
+  }
+  glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  return emit_frame(ctx, outFrame);
+}
+
+// Sends out the frames of the ring the GPU is done with, oldest first, and
+// waits for the oldest ones while max_inflight frames are still queued.
+static int emit_finished_readbacks(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  int ret;
+
+  while (c->packQueued) {
+    int slot = (c->packHead - c->packQueued + c->readback_depth) % c->readback_depth;
+    GLsync fence = c->packFences ? c->packFences[slot] : NULL;
+    if (c->packQueued < c->max_inflight &&
+        (!fence || glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)) {
+      break;
+    }
+    if ((ret = emit_oldest_readback(ctx)) < 0) {
+      return ret;
+    }
+  }
+  return 0;
+}
+
+static const char *const stage_names[NB_STAGES] = { "upload", "draw", "readback", "cpu" };
+
+static int timer_queries_supported(void)
+{
+#ifndef __APPLE__
+  return GLEW_ARB_timer_query;
+#else
+  return 1;
+#endif
+}
+
+static void init_timing(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  int i;
+
+  for (i = 0; i < GPU_STAGES; i++) {
+    c->gpuTimes[i] = -1.0f;
+  }
+  if (!timer_queries_supported()) {
+    av_log(ctx, AV_LOG_WARNING, "timer queries not supported, only timing the CPU\n");
+    return;
+  }
+  glGenQueries(TIMER_DEPTH * GPU_STAGES, c->timerQueries[0]);
+}
+
+static void add_timing_sample(GLTransitionContext *c, int stage, float ms)
+{
+  if (c->nbTimingSamples[stage] == c->timingSamplesSize[stage]) {
+    int size = FFMAX(2 * c->timingSamplesSize[stage], 256);
+    // a stage missing samples only skews its summary
+    if (av_reallocp_array(&c->timingSamples[stage], size, sizeof(float)) < 0) {
+      c->nbTimingSamples[stage] = c->timingSamplesSize[stage] = 0;
+      return;
+    }
+    c->timingSamplesSize[stage] = size;
+  }
+  c->timingSamples[stage][c->nbTimingSamples[stage]++] = ms;
+}
+
+// Reads the queries of the frames the GPU is done with, oldest first.
+static void collect_timings(GLTransitionContext *c)
+{
+  while (c->timerPending) {
+    int slot = (c->timerHead - c->timerPending + TIMER_DEPTH) % TIMER_DEPTH;
+    GLint available = 0;
+    GLuint64 ns;
+    int i;
+
+    // queries end in order, the last one of the frame being done means all are
+    glGetQueryObjectiv(c->timerQueries[slot][GPU_STAGES - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      break;
+    }
+    for (i = 0; i < GPU_STAGES; i++) {
+      glGetQueryObjectui64v(c->timerQueries[slot][i], GL_QUERY_RESULT, &ns);
+      c->gpuTimes[i] = ns / 1e6f;
+      add_timing_sample(c, i, c->gpuTimes[i]);
+    }
+    c->timerPending--;
+  }
+}
+
+static void begin_stage(GLTransitionContext *c, int stage)
+{
+  if (c->timerQueries[0][0]) {
+    glBeginQuery(GL_TIME_ELAPSED, c->timerQueries[c->timerHead][stage]);
+  }
+}
+
+static void end_stage(GLTransitionContext *c)
+{
+  if (c->timerQueries[0][0]) {
+    glEndQuery(GL_TIME_ELAPSED);
+  }
+}
+
+// Tags a rendered frame with the CPU time spent on it so far and the newest
+// GPU times, which belong to a frame a few before it.
+static void export_timings(AVFilterContext *ctx, AVFrame *frame)
+{
+  GLTransitionContext *c = ctx->priv;
+  float cpu = (av_gettime_relative() - c->blendStart) / 1000.0f;
+  char key[64], value[32];
+  int i;
+
+  if (c->timerQueries[0][0]) {
+    // a frame still in flight after a full ring is dropped, not waited for
+    if (c->timerPending < TIMER_DEPTH) {
+      c->timerPending++;
+    }
+    c->timerHead = (c->timerHead + 1) % TIMER_DEPTH;
+  }
+  add_timing_sample(c, STAGE_CPU, cpu);
+
+  snprintf(value, sizeof(value), "%zu", c->gpuMemory / 1024);
+  av_dict_set(&frame->metadata, "lavfi.gltransition.gpu_memory_kb", value, 0);
+
+  for (i = 0; i < NB_STAGES; i++) {
+    float ms = i == STAGE_CPU ? cpu : c->gpuTimes[i];
+    if (ms < 0) {
+      continue;
+    }
+    snprintf(key, sizeof(key), "lavfi.gltransition.%s_ms", stage_names[i]);
+    snprintf(value, sizeof(value), "%.3f", ms);
+    av_dict_set(&frame->metadata, key, value, 0);
+  }
+}
+
+static size_t planes_size(const TransitionFormat *fmt, int w, int h)
+{
+  size_t size = 0;
+  int p;
+  for (p = 0; p < fmt->nb_planes; p++) {
+    const PlaneFormat *pf = &fmt->planes[p];
+    size += (size_t)AV_CEIL_RSHIFT(w, pf->shift) * AV_CEIL_RSHIFT(h, pf->shift) * pf->bpp;
+  }
+  return size;
+}
+
+static size_t program_size(GLuint program)
+{
+#ifndef __APPLE__
+  GLint len = 0;
+  if (program && GLEW_ARB_get_program_binary) {
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &len);
+  }
+  return len;
+#else
+  return 0;
+#endif
+}
+
+// Programs and targets of the earlier passes of a transition.
+static size_t passes_size(const TransitionPass *passes, int nb_passes, int sample)
+{
+  size_t size = 0;
+  int i;
+  for (i = 0; i < nb_passes; i++) {
+    size += program_size(passes[i].program) + (size_t)passes[i].w * passes[i].h * 4 * sample;
+  }
+  return size;
+}
+
+// Adds up the storage this instance allocated, the program binary length
+// standing in for what the driver keeps of each program.
+static void estimate_gpu_memory(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  size_t size = sizeof(position);
+  int sample = c->fmt->planes[0].type == GL_UNSIGNED_SHORT ? 2 : 1;
+  int i;
+
+  if (!drm_frames(c)) {
+    for (i = FROM; i <= TO; i++) {
+      size += planes_size(c->fmt, AV_CEIL_RSHIFT(ctx->inputs[i]->w, c->prescaleShift[i]),
+                          AV_CEIL_RSHIFT(ctx->inputs[i]->h, c->prescaleShift[i]));
+    }
+    size += planes_size(c->fmt, outLink->w, outLink->h) * c->batch;
+  }
+  if (c->fmt->chroma) {
+    size += (size_t)outLink->w * outLink->h * 4 * sample;
+  }
+  if (c->packBufs) {
+    size += c->packSize * c->readback_depth;
+  }
+  if (c->outPool) {
+    size += c->outPool->slotSize * c->outPool->nb_slots;
+  }
+  if (c->uploadBuf) {
+    size += c->uploadSlotSize * c->upload_depth;
+  }
+
+  size += program_size(c->lumaProgram) + program_size(c->chromaProgram);
+  if (c->transitions) {
+    for (i = 0; i < c->nb_transitions; i++) {
+      size += program_size(c->transitions[i].program);
+      size += passes_size(c->transitions[i].passes, c->transitions[i].nb_passes, sample);
+    }
+  } else {
+    size += program_size(c->program);
+    size += passes_size(c->passes, c->nb_passes, sample);
+  }
+  if (c->prevTex) {
+    size += (size_t)outLink->w * outLink->h * 4 * sample;
+  }
+  c->gpuMemory = size;
+}
+
+// Transfers of 8 bit channels are the same whether packed or not.
+static GLenum transfer_type(GLenum type)
+{
+  return type == GL_UNSIGNED_INT_8_8_8_8_REV ? GL_UNSIGNED_BYTE : type;
+}
+
+// Tells when the driver uploads or reads back RGB pixels in another layout
+// than the negotiated one, so each transfer goes through a CPU conversion.
+static void check_native_format(AVFilterContext *ctx)
+{
+#ifndef __APPLE__
+  GLTransitionContext *c = ctx->priv;
+  static const GLenum pnames[] = { GL_TEXTURE_IMAGE_FORMAT, GL_READ_PIXELS_FORMAT };
+  const PlaneFormat *pf = &c->fmt->planes[0];
+  GLint format;
+  int i, j;
+
+  if (c->fmt->chroma || !GLEW_ARB_internalformat_query2) {
+    return;
+  }
+  for (i = 0; i < FF_ARRAY_ELEMS(pnames); i++) {
+    format = GL_NONE;
+    glGetInternalformativ(GL_TEXTURE_2D, pf->internalFormat, pnames[i], 1, &format);
+    if (format == GL_NONE || format == pf->format) {
+      continue;
+    }
+    // drivers don't reliably report the type, only suggest the same depth
+    for (j = 0; j < FF_ARRAY_ELEMS(transition_formats); j++) {
+      const PlaneFormat *native = &transition_formats[j].planes[0];
+      if (!transition_formats[j].chroma && native->format == format &&
+          transfer_type(native->type) == transfer_type(pf->type)) {
+        av_log(ctx, AV_LOG_VERBOSE, "%s is converted on %s, %s is native to the driver\n",
+               av_get_pix_fmt_name(c->fmt->pix_fmt), i ? "readback" : "upload",
+               av_get_pix_fmt_name(transition_formats[j].pix_fmt));
+        break;
+      }
+    }
+  }
+#endif
+}
+
+// How many of the upload and readback formats the driver reports for
+// GL_RGBA8 a pixel format transfers in as is.
+static int native_transfers(enum AVPixelFormat pix_fmt, const GLint *native, int nb_native)
+{
+  int i, j, n = 0;
+
+  for (i = 0; i < FF_ARRAY_ELEMS(transition_formats); i++) {
+    const PlaneFormat *pf = &transition_formats[i].planes[0];
+    if (transition_formats[i].pix_fmt == pix_fmt && pf->internalFormat == GL_RGBA8) {
+      for (j = 0; j < nb_native; j++) {
+        n += native[j] == pf->format;
+      }
+    }
+  }
+  return n;
+}
+
+// Moves the 4 byte formats the driver transfers without converting to the
+// front of a format list, asking the root context of the device since the
+// instance has none yet when formats are negotiated.
+static void order_native_formats(AVFilterContext *ctx, enum AVPixelFormat *formats, int nb_formats)
+{
+#ifndef __APPLE__
+  GLTransitionContext *c = ctx->priv;
+  static const GLenum pnames[] = { GL_TEXTURE_IMAGE_FORMAT, GL_READ_PIXELS_FORMAT };
+  GLint native[FF_ARRAY_ELEMS(pnames)];
+  SavedContext saved;
+  enum AVPixelFormat tmp;
+  int i, j;
+
+  // a device that can't be opened fails the configuration later on
+  if (!c->device && acquire_device(ctx, c->device_name) < 0) {
+    return;
+  }
+  if (make_root_current(c->device, &saved) < 0) {
+    return;
+  }
+  // device_lock is held until restore_context()
+  if (!c->device->glewReady) {
+    glewExperimental = GL_TRUE;
+    glewInit();
+    c->device->glewReady = 1;
+  }
+  for (i = 0; i < FF_ARRAY_ELEMS(pnames); i++) {
+    native[i] = GL_NONE;
+    if (GLEW_ARB_internalformat_query2) {
+      glGetInternalformativ(GL_TEXTURE_2D, GL_RGBA8, pnames[i], 1, &native[i]);
+    }
+  }
+  restore_context(c->device, &saved);
+
+  // stable, the formats both transfers take as is go before those only one does
+  for (i = 1; i < nb_formats; i++) {
+    for (j = i; j > 0 && native_transfers(formats[j - 1], native, FF_ARRAY_ELEMS(native)) <
+                         native_transfers(formats[j], native, FF_ARRAY_ELEMS(native)); j--) {
+      tmp = formats[j - 1];
+      formats[j - 1] = formats[j];
+      formats[j] = tmp;
+    }
+  }
+  av_log(ctx, AV_LOG_DEBUG, "%s preferred for transfers\n", av_get_pix_fmt_name(formats[0]));
+#endif
+}
+
+static int cmp_float(const void *a, const void *b)
+{
+  float fa = *(const float *)a, fb = *(const float *)b;
+  return (fa > fb) - (fa < fb);
+}
+
+static void log_timing_summary(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  int i, j;
+
+  if (c->gpuMemory) {
+    av_log(ctx, AV_LOG_INFO, "gpu memory %zu kB\n", c->gpuMemory / 1024);
+  }
+  for (i = 0; i < NB_STAGES; i++) {
+    float *samples = c->timingSamples[i];
+    int n = c->nbTimingSamples[i];
+    double sum = 0;
+
+    if (!n) {
+      continue;
+    }
+    qsort(samples, n, sizeof(*samples), cmp_float);
+    for (j = 0; j < n; j++) {
+      sum += samples[j];
+    }
+    av_log(ctx, AV_LOG_INFO, "%-8s %d frames, min %.3f avg %.3f p99 %.3f ms\n",
+           stage_names[i], n, samples[0], sum / n, samples[(int)ceil(n * 0.99) - 1]);
+  }
+}
+
+// Builds the column-major matrix converting the normalized YUV samples of
+// a frame (with 1 in w) to RGB, or RGB back to YUV when inverse is set.
+static void get_yuv_matrix(const AVFrame *frame, int inverse, float *m)
+{
+  int full = frame->color_range == AVCOL_RANGE_JPEG;
+  double s[3] = { full ? 1. : 255. / 219., full ? 1. : 255. / 224., full ? 1. : 255. / 224. };
+  double o[3] = { full ? 0. : 16. / 255., 128. / 255., 128. / 255. };
+  double kr, kb, kg;
+  double a[3][3], t[3];
+  int i, j;
+
+  switch (frame->colorspace) {
+  case AVCOL_SPC_BT709:
+    kr = 0.2126; kb = 0.0722;
+    break;
+  case AVCOL_SPC_BT2020_NCL:
+  case AVCOL_SPC_BT2020_CL:
+    kr = 0.2627; kb = 0.0593;
+    break;
+  case AVCOL_SPC_UNSPECIFIED:
+    if (frame->height >= 720) {
+      kr = 0.2126; kb = 0.0722;
+      break;
+    }
+    // fall through
+  default:
+    kr = 0.299; kb = 0.114;
+    break;
+  }
+  kg = 1. - kr - kb;
+
+  if (!inverse) {
+    double c[3][3] = {
+      { 1.,  0.,                         2. * (1. - kr) },
+      { 1., -2. * kb * (1. - kb) / kg,  -2. * kr * (1. - kr) / kg },
+      { 1.,  2. * (1. - kb),             0. },
+    };
+    for (i = 0; i < 3; i++) {
+      t[i] = 0;
+      for (j = 0; j < 3; j++) {
+        a[i][j] = c[i][j] * s[j];
+        t[i] -= a[i][j] * o[j];
+      }
+    }
+  } else {
+    double c[3][3] = {
+      { kr,                     kg,                     kb },
+      { -kr / (2. * (1. - kb)), -kg / (2. * (1. - kb)), 0.5 },
+      { 0.5,                    -kg / (2. * (1. - kr)), -kb / (2. * (1. - kr)) },
+    };
+    for (i = 0; i < 3; i++) {
+      t[i] = o[i];
+      for (j = 0; j < 3; j++)
+        a[i][j] = c[i][j] / s[i];
+    }
+  }
+
+  memset(m, 0, 16 * sizeof(float));
+  for (i = 0; i < 3; i++) {
+    for (j = 0; j < 3; j++)
+      m[j * 4 + i] = a[i][j];
+    m[12 + i] = t[i];
+  }
+  m[15] = 1;
+}
+
+static int create_yuv_targets(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  static const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+  const PlaneFormat rgbFormat = intermediate_format(c);
+  GLuint program;
+  int p;
+
+  c->rgbTex = create_tex(&rgbFormat, outLink->w, outLink->h);
+  glGenFramebuffers(1, &c->rgbFbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, c->rgbFbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, c->rgbTex, 0);
+
+  for (p = 0; p < c->fmt->nb_planes; p++) {
+    const PlaneFormat *pf = &c->fmt->planes[p];
+    int w = AV_CEIL_RSHIFT(outLink->w, pf->shift), h = AV_CEIL_RSHIFT(outLink->h, pf->shift);
+    c->planeTex[p] = drm_frames(c) ? create_empty_tex() :
+      c->batch > 1 ? create_tex_array(pf, w, h, c->batch) : create_tex(pf, w, h);
+  }
+
+  glGenFramebuffers(1, &c->lumaFbo);
+  glGenFramebuffers(1, &c->chromaFbo);
+  if (c->batch > 1) {
+    attach_batch_layer(c, 0);
+  } else {
+    glBindFramebuffer(GL_FRAMEBUFFER, c->lumaFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, c->planeTex[0], 0);
+    // both chroma planes are written at once, to two render targets for
+    // planar formats or to the single interleaved plane otherwise
+    glBindFramebuffer(GL_FRAMEBUFFER, c->chromaFbo);
+    for (p = 1; p < c->fmt->nb_planes; p++) {
+      glFramebufferTexture2D(GL_FRAMEBUFFER, drawBuffers[p - 1], GL_TEXTURE_2D, c->planeTex[p], 0);
+    }
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, c->chromaFbo);
+  glDrawBuffers(c->fmt->nb_planes - 1, drawBuffers);
+
+  // the planes of mapped output only have storage once a frame is mapped
+  if (!drm_frames(c) &&
+      glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    av_log(ctx, AV_LOG_ERROR, "incomplete framebuffer for %s output\n", av_get_pix_fmt_name(c->fmt->pix_fmt));
+    return AVERROR_EXTERNAL;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  if (!(c->lumaProgram = create_program(ctx, f_luma_source)) ||
+      !(c->chromaProgram = create_program(ctx, f_chroma_source))) {
+    return -1;
+  }
+
+  for (p = 0; p < 2; p++) {
+    const PlaneFormat *pf = &c->fmt->planes[p];
+    program = p ? c->chromaProgram : c->lumaProgram;
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "rgb"), RGB_UNIT);
+    glUniform2f(glGetUniformLocation(program, "size"),
+                AV_CEIL_RSHIFT(outLink->w, pf->shift), AV_CEIL_RSHIFT(outLink->h, pf->shift));
+  }
+  c->lumaCsp = glGetUniformLocation(c->lumaProgram, "csp");
+  c->chromaCsp = glGetUniformLocation(c->chromaProgram, "csp");
+  glUseProgram(c->program);
+  return 0;
+}
+
+// Builds the compute program of compute=1 where it can be used, pack
+// buffers are then created whatever readback_depth is.
+static int create_compute_pack(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  GLint sizes[6], status;
+  GLuint shader;
+  int p;
+
+  if (!c->fmt->chroma || c->batch > 1) {
+    av_log(ctx, AV_LOG_WARNING, "compute has no effect on RGB output and with batch\n");
+    return 0;
+  }
+  if (!(GLEW_VERSION_4_3 || (GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object))) {
+    av_log(ctx, AV_LOG_WARNING, "compute shaders not supported, reading planes back one by one\n");
+    return 0;
+  }
+  if (!(shader = build_shader(ctx, c_pack_source, GL_COMPUTE_SHADER))) {
+    return -1;
+  }
+  c->computeProgram = glCreateProgram();
+  glAttachShader(c->computeProgram, shader);
+  glLinkProgram(c->computeProgram);
+  glDeleteShader(shader);
+  glGetProgramiv(c->computeProgram, GL_LINK_STATUS, &status);
+  if (status != GL_TRUE) {
+    char log[10000];
+    glGetProgramInfoLog(c->computeProgram, sizeof(log), NULL, log);
+    av_log(ctx, AV_LOG_ERROR, "invalid compute program: %s\n", log);
+    return -1;
+  }
+
+  for (p = 0; p < MAX_PLANES; p++) {
+    int shift = p < c->fmt->nb_planes ? c->fmt->planes[p].shift : 0;
+    sizes[2 * p] = AV_CEIL_RSHIFT(outLink->w, shift);
+    sizes[2 * p + 1] = AV_CEIL_RSHIFT(outLink->h, shift);
+  }
+  glUseProgram(c->computeProgram);
+  glUniform1i(glGetUniformLocation(c->computeProgram, "rgb"), RGB_UNIT);
+  glUniform1i(glGetUniformLocation(c->computeProgram, "bytes"), c->fmt->planes[0].bpp);
+  glUniform1i(glGetUniformLocation(c->computeProgram, "interleaved"), c->fmt->nb_planes == 2);
+  glUniform2iv(glGetUniformLocation(c->computeProgram, "sizes"), MAX_PLANES, sizes);
+  c->computeCsp = glGetUniformLocation(c->computeProgram, "csp");
+  glUseProgram(c->program);
+  return 0;
+}
+
+// The plane layout is only known once the pack buffers are created.
+static void set_pack_layout(GLTransitionContext *c)
+{
+  GLint offsets[MAX_PLANES + 1] = { 0 };
+  int p;
+
+  for (p = 0; p < c->fmt->nb_planes; p++) {
+    offsets[p] = c->packOffsets[p];
+  }
+  for (; p <= MAX_PLANES; p++) {
+    offsets[p] = c->packSize;
+  }
+  glUseProgram(c->computeProgram);
+  glUniform1iv(glGetUniformLocation(c->computeProgram, "linesizes"), c->fmt->nb_planes, c->packLinesizes);
+  glUniform1iv(glGetUniformLocation(c->computeProgram, "offsets"), MAX_PLANES + 1, offsets);
+  glUseProgram(c->program);
+}
+
+// Writes the image rendered into rgbTex to the YUV output planes.
+static void convert_to_yuv(AVFilterContext *ctx, const AVFrame *outFrame)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  int shift = c->fmt->planes[1].shift;
+  float csp[16];
+
+  get_yuv_matrix(outFrame, 1, csp);
+
+  glActiveTexture(GL_TEXTURE0 + RGB_UNIT);
+  glBindTexture(GL_TEXTURE_2D, c->rgbTex);
+
+  if (c->computeProgram) {
+    // one word per invocation, in rows of at most 65535 work groups
+    GLuint groups = (c->packSize / 4 + 255) / 256;
+    GLuint rows = (groups + 65534) / 65535;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glUseProgram(c->computeProgram);
+    glUniformMatrix4fv(c->computeCsp, 1, GL_FALSE, csp);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, c->packBufs[c->packHead]);
+    glDispatchCompute((groups + rows - 1) / rows, rows, 1);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    return;
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, c->lumaFbo);
+  glUseProgram(c->lumaProgram);
+  glUniformMatrix4fv(c->lumaCsp, 1, GL_FALSE, csp);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, c->chromaFbo);
+  glViewport(0, 0, AV_CEIL_RSHIFT(outLink->w, shift), AV_CEIL_RSHIFT(outLink->h, shift));
+  glUseProgram(c->chromaProgram);
+  glUniformMatrix4fv(c->chromaCsp, 1, GL_FALSE, csp);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+
+  glViewport(0, 0, outLink->w, outLink->h);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Reads every output plane, either into memory or, with a pixel pack
+// buffer bound, into the buffer at the offsets given in data.
+static void read_output(AVFilterContext *ctx, uint8_t *const data[], const int linesize[])
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  int p;
+
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  for (p = 0; p < c->fmt->nb_planes; p++) {
+    const PlaneFormat *pf = &c->fmt->planes[p];
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, p ? c->chromaFbo : c->fmt->chroma ? c->lumaFbo : c->outFbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0 + (p ? p - 1 : 0));
+    glPixelStorei(GL_PACK_ROW_LENGTH, linesize[p] / pf->bpp);
+    glReadPixels(0, 0, AV_CEIL_RSHIFT(outLink->w, pf->shift), AV_CEIL_RSHIFT(outLink->h, pf->shift),
+                 pf->format, pf->type, data[p]);
+  }
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+#ifdef GL_TRANSITION_HWMAP_DRM
+static int init_drm_interop(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  const char *exts = eglQueryString(c->eglDpy, EGL_EXTENSIONS);
+
+  if (!exts || !strstr(exts, "EGL_EXT_image_dma_buf_import")) {
+    av_log(ctx, AV_LOG_ERROR, "EGL_EXT_image_dma_buf_import is needed for %s frames\n",
+           av_get_pix_fmt_name(c->hwFormat));
+    return AVERROR(ENOSYS);
+  }
+  c->drmModifiers = !!strstr(exts, "EGL_EXT_image_dma_buf_import_modifiers");
+
+  c->eglCreateImageKHR = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+  c->eglDestroyImageKHR = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+  c->eglImageTargetTexture2DOES = (void (*)(GLenum, void *))eglGetProcAddress("glEGLImageTargetTexture2DOES");
+  if (!c->eglCreateImageKHR || !c->eglDestroyImageKHR || !c->eglImageTargetTexture2DOES) {
+    av_log(ctx, AV_LOG_ERROR, "EGL image functions not available\n");
+    return AVERROR(ENOSYS);
+  }
+  return 0;
+}
+
+static uint32_t drm_plane_format(const PlaneFormat *pf)
+{
+  switch (pf->internalFormat) {
+  case GL_R8:   return DRM_FORMAT_R8;
+  case GL_RG8:  return DRM_FORMAT_GR88;
+  case GL_R16:  return DRM_FORMAT_R16;
+  case GL_RG16: return DRM_FORMAT_GR1616;
+  }
+  return 0;
+}
+
+// Makes a plane of a DRM PRIME frame the storage of tex.
+static int import_drm_plane(AVFilterContext *ctx, GLuint tex, const AVDRMFrameDescriptor *desc,
+                            const AVDRMPlaneDescriptor *plane, const PlaneFormat *pf, int w, int h)
+{
+  GLTransitionContext *c = ctx->priv;
+  const AVDRMObjectDescriptor *obj = &desc->objects[plane->object_index];
+  EGLImageKHR image;
+  EGLint attribs[] = {
+    EGL_WIDTH, w,
+    EGL_HEIGHT, h,
+    EGL_LINUX_DRM_FOURCC_EXT, drm_plane_format(pf),
+    EGL_DMA_BUF_PLANE0_FD_EXT, obj->fd,
+    EGL_DMA_BUF_PLANE0_OFFSET_EXT, plane->offset,
+    EGL_DMA_BUF_PLANE0_PITCH_EXT, plane->pitch,
+    EGL_NONE, 0,
+    EGL_NONE, 0,
+    EGL_NONE
+  };
+
+  if (c->drmModifiers && obj->format_modifier != DRM_FORMAT_MOD_INVALID) {
+    attribs[12] = EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT;
+    attribs[13] = obj->format_modifier & 0xffffffff;
+    attribs[14] = EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT;
+    attribs[15] = obj->format_modifier >> 32;
+  }
+
+  image = c->eglCreateImageKHR(c->eglDpy, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+  if (image == EGL_NO_IMAGE_KHR) {
+    av_log(ctx, AV_LOG_ERROR, "importing DRM PRIME plane failed: 0x%x\n", eglGetError());
+    return AVERROR_EXTERNAL;
+  }
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  c->eglImageTargetTexture2DOES(GL_TEXTURE_2D, image);
+  // the texture keeps the buffer referenced
+  c->eglDestroyImageKHR(c->eglDpy, image);
+  return 0;
+}
+
+#if CONFIG_VULKAN
+// Whether a frame of the output pool can be mapped to DRM PRIME for writing,
+// which the Vulkan hwcontext only exports on some devices and versions.
+static int probe_vulkan_export(AVFilterContext *ctx, AVBufferRef *framesRef)
+{
+  AVFrame *frame = av_frame_alloc(), *drmFrame = av_frame_alloc();
+  int ret;
+
+  if (!frame || !drmFrame) {
+    ret = AVERROR(ENOMEM);
+  } else if ((ret = av_hwframe_get_buffer(framesRef, frame, 0)) >= 0) {
+    drmFrame->format = AV_PIX_FMT_DRM_PRIME;
+    ret = av_hwframe_map(drmFrame, frame, AV_HWFRAME_MAP_WRITE | AV_HWFRAME_MAP_OVERWRITE);
+  }
+  if (ret < 0) {
+    av_log(ctx, AV_LOG_ERROR, "vulkan output frames can't be exported as DRM PRIME, "
+           "the device needs VK_EXT_external_memory_dma_buf\n");
+  }
+  av_frame_free(&drmFrame);
+  av_frame_free(&frame);
+  return ret;
+}
+#endif
+
+// Maps a VAAPI or Vulkan frame to DRM PRIME and imports its planes into
+// texs, keeping the mapping alive in *mapped until the next frame replaces it.
+static int map_drm_frame(AVFilterContext *ctx, GLuint *texs, AVFrame **mapped, const AVFrame *frame, int flags)
+{
+  GLTransitionContext *c = ctx->priv;
+  const AVDRMFrameDescriptor *desc;
+  AVFrame *drmFrame;
+  int l, i, p = 0, ret;
+
+  if (!(drmFrame = av_frame_alloc())) {
+    return AVERROR(ENOMEM);
+  }
+  drmFrame->format = AV_PIX_FMT_DRM_PRIME;
+  if ((ret = av_hwframe_map(drmFrame, frame, flags)) < 0) {
+    av_log(ctx, AV_LOG_ERROR, "mapping %s frame to DRM PRIME failed\n", av_get_pix_fmt_name(frame->format));
+    av_frame_free(&drmFrame);
+    return ret;
+  }
+
+  // planes can come as separate layers or as the planes of a single one
+  desc = (const AVDRMFrameDescriptor *)drmFrame->data[0];
+  for (l = 0; l < desc->nb_layers; l++) {
+    for (i = 0; i < desc->layers[l].nb_planes && p < c->fmt->nb_planes; i++, p++) {
+      const PlaneFormat *pf = &c->fmt->planes[p];
+      if ((ret = import_drm_plane(ctx, texs[p], desc, &desc->layers[l].planes[i], pf,
+                                  AV_CEIL_RSHIFT(frame->width, pf->shift),
+                                  AV_CEIL_RSHIFT(frame->height, pf->shift))) < 0) {
+        av_frame_free(&drmFrame);
+        return ret;
+      }
+    }
+  }
+  if (p != c->fmt->nb_planes) {
+    av_log(ctx, AV_LOG_ERROR, "DRM PRIME frame has %d planes, %d expected\n", p, c->fmt->nb_planes);
+    av_frame_free(&drmFrame);
+    return AVERROR(EINVAL);
+  }
+
+  av_frame_free(mapped);
+  *mapped = drmFrame;
+  return 0;
+}
+#endif
+
+#ifdef GL_TRANSITION_HWMAP_CUDA
+static int register_cuda_textures(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVHWFramesContext *frames = (AVHWFramesContext *)ctx->inputs[FROM]->hw_frames_ctx->data;
+  CudaFunctions *cu;
+  CUcontext dummy;
+  int input, p, ret;
+
+  c->cuda = frames->device_ctx->hwctx;
+  cu = c->cuda->internal->cuda_dl;
+
+  if ((ret = CHECK_CU(cu->cuCtxPushCurrent(c->cuda->cuda_ctx))) < 0) {
+    return ret;
+  }
+  for (input = FROM; input <= OUTPUT && ret >= 0; input++) {
+    for (p = 0; p < c->fmt->nb_planes && ret >= 0; p++) {
+      ret = CHECK_CU(cu->cuGraphicsGLRegisterImage(&c->cuRes[input][p],
+                                                   input == OUTPUT ? c->planeTex[p] : c->tex[input][p],
+                                                   GL_TEXTURE_2D,
+                                                   input == OUTPUT ? CU_GRAPHICS_REGISTER_FLAGS_READ_ONLY :
+                                                   CU_GRAPHICS_REGISTER_FLAGS_WRITE_DISCARD));
+    }
+  }
+  CHECK_CU(cu->cuCtxPopCurrent(&dummy));
+  return ret;
+}
+
+// Copies the planes of a CUDA frame into the registered textures res, or
+// the other way around for the output.
+static int copy_cuda_frame(AVFilterContext *ctx, CUgraphicsResource *res, const AVFrame *frame, int output)
+{
+  GLTransitionContext *c = ctx->priv;
+  CudaFunctions *cu = c->cuda->internal->cuda_dl;
+  CUcontext dummy;
+  int p, ret;
+
+  if ((ret = CHECK_CU(cu->cuCtxPushCurrent(c->cuda->cuda_ctx))) < 0) {
+    return ret;
+  }
+  // mapping and unmapping order the copies against the GL commands
+  if ((ret = CHECK_CU(cu->cuGraphicsMapResources(c->fmt->nb_planes, res, c->cuda->stream))) < 0) {
+    CHECK_CU(cu->cuCtxPopCurrent(&dummy));
+    return ret;
+  }
+  for (p = 0; p < c->fmt->nb_planes && ret >= 0; p++) {
+    const PlaneFormat *pf = &c->fmt->planes[p];
+    CUDA_MEMCPY2D cpy = {
+      .WidthInBytes = AV_CEIL_RSHIFT(frame->width, pf->shift) * pf->bpp,
+      .Height       = AV_CEIL_RSHIFT(frame->height, pf->shift),
+    };
+    CUarray array;
+
+    if ((ret = CHECK_CU(cu->cuGraphicsSubResourceGetMappedArray(&array, res[p], 0, 0))) < 0) {
+      break;
+    }
+    if (output) {
+      cpy.srcMemoryType = CU_MEMORYTYPE_ARRAY;
+      cpy.srcArray      = array;
+      cpy.dstMemoryType = CU_MEMORYTYPE_DEVICE;
+      cpy.dstDevice     = (CUdeviceptr)frame->data[p];
+      cpy.dstPitch      = frame->linesize[p];
+    } else {
+      cpy.srcMemoryType = CU_MEMORYTYPE_DEVICE;
+      cpy.srcDevice     = (CUdeviceptr)frame->data[p];
+      cpy.srcPitch      = frame->linesize[p];
+      cpy.dstMemoryType = CU_MEMORYTYPE_ARRAY;
+      cpy.dstArray      = array;
+    }
+    ret = CHECK_CU(cu->cuMemcpy2DAsync(&cpy, c->cuda->stream));
+  }
+  CHECK_CU(cu->cuGraphicsUnmapResources(c->fmt->nb_planes, res, c->cuda->stream));
+  if (ret >= 0 && output) {
+    ret = CHECK_CU(cu->cuStreamSynchronize(c->cuda->stream));
+  }
+  CHECK_CU(cu->cuCtxPopCurrent(&dummy));
+  return ret;
+}
+#endif
+
+// Creates the hardware frames context of the output, on the device of the
+// inputs and with their software format, which it returns.
+static int config_hw_output(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  AVHWFramesContext *fromFrames, *toFrames, *outFrames;
+  int ret, i;
+
+  for (i = 0; i < ctx->nb_inputs; i++) {
+    if (!ctx->inputs[i]->hw_frames_ctx) {
+      av_log(ctx, AV_LOG_ERROR, "hardware frames context missing on the inputs\n");
+      return AVERROR(EINVAL);
+    }
+  }
+  fromFrames = (AVHWFramesContext *)ctx->inputs[FROM]->hw_frames_ctx->data;
+  for (i = 1; i < ctx->nb_inputs; i++) {
+    toFrames = (AVHWFramesContext *)ctx->inputs[i]->hw_frames_ctx->data;
+    if (fromFrames->sw_format != toFrames->sw_format) {
+      av_log(ctx, AV_LOG_ERROR, "inputs must be of same software pixel format\n");
+      return AVERROR(EINVAL);
+    }
+  }
+
+  av_buffer_unref(&outLink->hw_frames_ctx);
+  if (!(outLink->hw_frames_ctx = av_hwframe_ctx_alloc(fromFrames->device_ref))) {
+    return AVERROR(ENOMEM);
+  }
+  outFrames = (AVHWFramesContext *)outLink->hw_frames_ctx->data;
+  outFrames->format = outLink->format;
+  outFrames->sw_format = fromFrames->sw_format;
+  outFrames->width = outLink->w;
+  outFrames->height = outLink->h;
+#if defined(GL_TRANSITION_HWMAP_DRM) && CONFIG_VULKAN
+  // linear images, so the export needs no modifier support to be imported
+  if (outFrames->format == AV_PIX_FMT_VULKAN) {
+    ((AVVulkanFramesContext *)outFrames->hwctx)->tiling = VK_IMAGE_TILING_LINEAR;
+  }
+#endif
+  if ((ret = ff_filter_init_hw_frames(ctx, outLink, 10)) < 0 ||
+      (ret = av_hwframe_ctx_init(outLink->hw_frames_ctx)) < 0) {
+    av_log(ctx, AV_LOG_ERROR, "creating output hardware frames context failed\n");
+    return ret;
+  }
+#if defined(GL_TRANSITION_HWMAP_DRM) && CONFIG_VULKAN
+  if (outFrames->format == AV_PIX_FMT_VULKAN &&
+      (ret = probe_vulkan_export(ctx, outLink->hw_frames_ctx)) < 0) {
+    return ret;
+  }
+#endif
+
+  c->hwFormat = outLink->format;
+  return fromFrames->sw_format;
+}
+
+// Gives the textures of an input, or the output planes, the contents or
+// storage of a hardware frame.
+static int import_hw_frame(AVFilterContext *ctx, int input, const AVFrame *frame)
+{
+  GLTransitionContext *c = ctx->priv;
+
+#ifdef GL_TRANSITION_HWMAP_DRM
+  if (drm_frames(c)) {
+    static const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    int ret, p;
+
+    if (input != OUTPUT) {
+      return map_drm_frame(ctx, c->tex[input], &c->drmFrames[input], frame, AV_HWFRAME_MAP_READ);
+    }
+    if ((ret = map_drm_frame(ctx, c->planeTex, &c->drmFrames[OUTPUT], frame,
+                             AV_HWFRAME_MAP_WRITE | AV_HWFRAME_MAP_OVERWRITE)) < 0) {
+      return ret;
+    }
+    // attach again so the framebuffers pick up the new storage
+    glBindFramebuffer(GL_FRAMEBUFFER, c->lumaFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, c->planeTex[0], 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, c->chromaFbo);
+    for (p = 1; p < c->fmt->nb_planes; p++) {
+      glFramebufferTexture2D(GL_FRAMEBUFFER, drawBuffers[p - 1], GL_TEXTURE_2D, c->planeTex[p], 0);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return 0;
+  }
+#endif
+#ifdef GL_TRANSITION_HWMAP_CUDA
+  if (c->hwFormat == AV_PIX_FMT_CUDA) {
+    // the output is copied out once rendered
+    return input == OUTPUT ? 0 : copy_cuda_frame(ctx, c->cuRes[input], frame, 0);
+  }
+#endif
+  return AVERROR_BUG;
+}
+
+// Completes the output frame once the planes have been rendered.
+static int export_hw_frame(AVFilterContext *ctx, AVFrame *outFrame)
+{
+  GLTransitionContext *c = ctx->priv;
+
+#ifdef GL_TRANSITION_HWMAP_DRM
+  if (drm_frames(c)) {
+    // nothing downstream waits on GL, so finish before unmapping
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    wait_fence(&fence);
+    av_frame_free(&c->drmFrames[OUTPUT]);
+    return 0;
+  }
+#endif
+#ifdef GL_TRANSITION_HWMAP_CUDA
+  if (c->hwFormat == AV_PIX_FMT_CUDA) {
+    return copy_cuda_frame(ctx, c->cuRes[OUTPUT], outFrame, 1);
+  }
+#endif
+  return AVERROR_BUG;
+}
+
+static void get_matrix(int method, float * m, float ratio, float xratio) {
+  float sx, sy;
+  memset(m, 0, 9*sizeof(float));
+  switch (method) {
+  case CONTAIN: 
+    sx = fmax(ratio/xratio, 1.f);
+    sy = fmax(xratio/ratio, 1.f); 
+    break;
+  case COVER:
+    sx = fmin(ratio/xratio, 1.f);
+    sy = fmin(xratio/ratio, 1.f);
+    break;
+  case STRETCH:
+    sx = 1;
+    sy = 1;
+    break;
+  }
+  m[0] = sx;
+  m[2] = -0.5 * sx + 0.5;
+  m[4] = -sy;
+  m[5] = 0.5 * sy + 0.5;
+  m[8] = 1;
+}
+
+static void set_uniform(GLint loc, const UniformType *type, const UniformValue *v)
+{
+  if (type->integer) {
+    switch (type->n) {
+    case 1: glUniform1iv(loc, 1, v->i); break;
+    case 2: glUniform2iv(loc, 1, v->i); break;
+    case 3: glUniform3iv(loc, 1, v->i); break;
+    case 4: glUniform4iv(loc, 1, v->i); break;
+    }
+  } else {
+    switch (type->n) {
+    case 1: glUniform1fv(loc, 1, v->f); break;
+    case 2: glUniform2fv(loc, 1, v->f); break;
+    case 3: glUniform3fv(loc, 1, v->f); break;
+    case 4: glUniform4fv(loc, 1, v->f); break;
+    }
+  }
+}
+
+// Sets the uniforms of a program in use: those of the filter and the ones of
+// the transition, to the value given by the uniforms option or else to their
+// default, for the pass-th pass of the transition.
+static int init_program_uniforms(AVFilterContext *ctx, GLuint program, int pass)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *fromLink = ctx->inputs[FROM];
+  AVFilterLink *toLink = ctx->inputs[TO];
+  AVFilterLink *outLink = ctx->outputs[0];
+  const UniformTable *t = c->uniformTable;
+  const AVDictionaryEntry *e;
+  float mfrom[9];
+  float mto[9];
+  float ratio = outLink->w / (float)outLink->h;
+  float fromR = fromLink->w / (float)fromLink->h;
+  float toR = toLink->w / (float)toLink->h;  
+  static const char *const samplers[2][MAX_PLANES] = {
+    { "from", "from1", "from2" },
+    { "to", "to1", "to2" },
+  };
+  char name[16];
+  int i;
+
+  for (i = 0; i < t->nb_uniforms; i++) {
+    const UniformDesc *u = &t->uniforms[i];
+    UniformValue v = u->def;
+    GLint loc;
+
+    e = av_dict_get(c->uniforms, u->name, NULL, 0);
+    if (e && parse_uniform_value(u->type, e->value, &v) < 0) {
+      av_log(ctx, AV_LOG_ERROR, "parsing %s %s for uniform %s\n", u->type->name, e->value, u->name);
+      return AVERROR(EINVAL);
+    }
+    if (!e && !u->hasDefault) {
+      continue;
+    }
+    // unused uniforms are optimized out
+    if ((loc = glGetUniformLocation(program, u->name)) < 0) {
+      av_log(ctx, AV_LOG_DEBUG, "uniform %s is not used\n", u->name);
+      continue;
+    }
+    set_uniform(loc, u->type, &v);
+  }
+
+  for (i = 0; i < MAX_PLANES; i++) {
+    glUniform1i(glGetUniformLocation(program, samplers[FROM][i]), TEX_UNIT(FROM, i));
+    glUniform1i(glGetUniformLocation(program, samplers[TO][i]), TEX_UNIT(TO, i));
+  }
+  for (i = 0; i < pass; i++) {
+    snprintf(name, sizeof(name), "pass%d", i);
+    glUniform1i(glGetUniformLocation(program, name), PASS_UNIT(i));
+  }
+  glUniform1i(glGetUniformLocation(program, "previous"), PREVIOUS_UNIT);
+  glUniform1f(glGetUniformLocation(program, "progress"), 0.0f);
+
+  glUniform1f(glGetUniformLocation(program, "ratio"), ratio);
+
+  get_matrix(c->resize, mfrom, ratio, fromR);
+  glUniformMatrix3fv(glGetUniformLocation(program, "mfrom"), 1, GL_FALSE, mfrom);
+  get_matrix(c->resize, mto, ratio, toR);    
+  glUniformMatrix3fv(glGetUniformLocation(program, "mto"), 1, GL_FALSE, mto);  
+  return 0;
+}
+
+// Sets the uniforms of the program just built and of its earlier passes,
+// leaving the program in use.
+static int init_uniforms(AVFilterContext * ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  const UniformTable *t = c->uniformTable;
+  const AVDictionaryEntry *e = NULL;
+  int i, ret;
+
+  while ((e = av_dict_get(c->uniforms, "", e, AV_DICT_IGNORE_SUFFIX))) {
+    for (i = 0; i < t->nb_uniforms && !streq(t->uniforms[i].name, e->key); i++);
+    if (i == t->nb_uniforms) {
+      av_log(ctx, AV_LOG_ERROR, "the transition has no uniform named %s\n", e->key);
+      return AVERROR(EINVAL);
+    }
+  }
+
+  for (i = 0; i < c->nb_passes; i++) {
+    TransitionPass *p = &c->passes[i];
+    glUseProgram(p->program);
+    if ((ret = init_program_uniforms(ctx, p->program, i)) < 0) {
+      return ret;
+    }
+    p->yuvfrom = glGetUniformLocation(p->program, "yuvfrom");
+    p->yuvto = glGetUniformLocation(p->program, "yuvto");
+    p->progress = glGetUniformLocation(p->program, "progress");
+  }
+  glUseProgram(c->program);
+  if ((ret = init_program_uniforms(ctx, c->program, c->nb_passes)) < 0) {
+    return ret;
+  }
+  c->yuvfrom = glGetUniformLocation(c->program, "yuvfrom");
+  c->yuvto = glGetUniformLocation(c->program, "yuvto");
+  c->progress = glGetUniformLocation(c->program, "progress");
+  return 0;
+}
+
+static int64_t seconds_to_pts(double t, AVRational tb)
+{
+  return av_rescale_q(llrint(t * AV_TIME_BASE), AV_TIME_BASE_Q, tb);
+}
+
+// Progress of a frame in a window given in timestamps, 0 up to start and 1
+// from end on. Everything but the fraction in between is exact.
+static float window_progress(int64_t pts, int64_t start, int64_t end)
+{
+  if (pts <= start) {
+    return 0.0f;
+  }
+  if (pts >= end) {
+    return 1.0f;
+  }
+  return (double)(pts - start) / (end - start);
+}
+
+// Moves the transition window to start at pts, once at the first frame, on
+// trigger and whenever a command changes offset or duration.
+static void update_window(AVFilterContext *ctx, AVRational tb, int64_t start)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVRational frameRate = ctx->outputs[0]->frame_rate;
+
+  c->windowStart = start;
+  c->windowEnd = start + seconds_to_pts(c->duration, tb);
+  c->windowOffset = c->offset;
+  c->windowDuration = c->duration;
+
+  // the first frame after the start and the last one before the end
+  if (frameRate.num > 0 && frameRate.den > 0) {
+    AVRational frameTb = av_inv_q(frameRate);
+    c->windowFirst = av_rescale_q_rnd(c->windowStart, tb, frameTb, AV_ROUND_DOWN) + 1;
+    c->windowLast = av_rescale_q_rnd(c->windowEnd, tb, frameTb, AV_ROUND_UP) - 1;
+    av_log(ctx, AV_LOG_VERBOSE, "transition window: frames %"PRId64" to %"PRId64"\n",
+           FFMAX(c->windowFirst, 0), c->windowLast);
+  } else {
+    c->windowFirst = c->windowLast = -1;
+  }
+}
+
+static float get_progress(AVFilterContext *ctx, FFFrameSync *fs)
+{
+  GLTransitionContext *c = ctx->priv;
+  int64_t pts = fs->pts - c->first_pts;
+
+  if (c->trigger) {
+    c->offset = pts * av_q2d(fs->time_base);
+    update_window(ctx, fs->time_base, pts);
+    c->trigger = 0;
+  } else if (c->offset != c->windowOffset || c->duration != c->windowDuration) {
+    update_window(ctx, fs->time_base, seconds_to_pts(c->offset, fs->time_base));
+  }
+  if (c->fixed_progress >= 0.0) {
+    return c->fixed_progress;
+  }
+  return window_progress(pts, c->windowStart, c->windowEnd);
+}
+
+// Whether a frame at pts is the last one drawn before the window ends, the
+// next one being past it as far as the output frame rate tells.
+static int last_in_window(AVFilterContext *ctx, FFFrameSync *fs)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVRational frameRate = ctx->outputs[0]->frame_rate;
+  int64_t pts = fs->pts - c->first_pts;
+
+  if (frameRate.num <= 0 || frameRate.den <= 0 || c->fixed_progress >= 0.0) {
+    return 0;
+  }
+  return pts > c->windowStart && pts < c->windowEnd &&
+         pts + av_rescale_q(1, av_inv_q(frameRate), fs->time_base) >= c->windowEnd;
+}
+
+// Keeps the locations of the transition uniforms for process_command() to
+// change them without looking them up again.
+static int init_runtime_uniforms(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  const UniformTable *t = c->uniformTable;
+  int i, k;
+
+  if (!t->nb_uniforms) {
+    return 0;
+  }
+  if (!(c->uniformLocs = av_calloc(t->nb_uniforms, sizeof(*c->uniformLocs)))) {
+    return AVERROR(ENOMEM);
+  }
+  for (i = 0; i < t->nb_uniforms; i++) {
+    c->uniformLocs[i] = glGetUniformLocation(c->program, t->uniforms[i].name);
+  }
+  for (k = 0; k < c->nb_passes; k++) {
+    TransitionPass *p = &c->passes[k];
+    if (!(p->uniformLocs = av_calloc(t->nb_uniforms, sizeof(*p->uniformLocs)))) {
+      return AVERROR(ENOMEM);
+    }
+    for (i = 0; i < t->nb_uniforms; i++) {
+      p->uniformLocs[i] = glGetUniformLocation(p->program, t->uniforms[i].name);
+    }
+  }
+  return 0;
+}
+
+static void use_transition(GLTransitionContext *c, int i)
+{
+  const TimelineTransition *t = &c->transitions[i];
+  c->program = t->program;
+  c->progress = t->progress;
+  c->yuvfrom = t->yuvfrom;
+  c->yuvto = t->yuvto;
+  c->uniformTable = t->uniformTable;
+  c->uniformLocs = t->uniformLocs;
+  c->passes = t->passes;
+  c->nb_passes = t->nb_passes;
+}
+
+// Sets the uniform values process_command() received before the frame
+// about to be drawn, in the order they came.
+static void update_uniforms(GLTransitionContext *c)
+{
+  const UniformTable *t = c->uniformTable;
+  int i, k, n = 0;
+
+  if (c->renderRunning) {
+    ff_mutex_lock(&c->renderLock);
+  }
+  for (i = 0; i < c->nbUniformUpdates; i++) {
+    const UniformUpdate *u = &c->uniformUpdates[i];
+    if ((int)(u->seq - c->drawSeq) > 0) {
+      c->uniformUpdates[n++] = *u;
+    } else if (u->index < 0) {
+      use_transition(c, u->transition);
+      glUseProgram(c->program);
+      t = c->uniformTable;
+    } else {
+      for (k = 0; k < c->nb_passes; k++) {
+        const TransitionPass *p = &c->passes[k];
+        if (p->uniformLocs[u->index] >= 0) {
+          glUseProgram(p->program);
+          set_uniform(p->uniformLocs[u->index], t->uniforms[u->index].type, &u->value);
+          glUseProgram(c->program);
+        }
+      }
+      if (c->uniformLocs[u->index] >= 0) {
+        set_uniform(c->uniformLocs[u->index], t->uniforms[u->index].type, &u->value);
+      }
+    }
+  }
+  atomic_fetch_sub(&c->uniformsQueued, c->nbUniformUpdates - n);
+  c->nbUniformUpdates = n;
+  if (c->renderRunning) {
+    ff_mutex_unlock(&c->renderLock);
+  }
+}
+
+// Draws the passes before the last one into their targets, each sampling
+// those before it.
+static void draw_passes(AVFilterContext *ctx, float progress, const float *cspFrom, const float *cspTo)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  int i;
+
+  for (i = 0; i < c->nb_passes; i++) {
+    const TransitionPass *p = &c->passes[i];
+    glUseProgram(p->program);
+    glUniform1f(p->progress, progress);
+    if (c->fmt->chroma) {
+      glUniformMatrix4fv(p->yuvfrom, 1, GL_FALSE, cspFrom);
+      glUniformMatrix4fv(p->yuvto, 1, GL_FALSE, cspTo);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, p->fbo);
+    glViewport(0, 0, p->w, p->h);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glActiveTexture(GL_TEXTURE0 + PASS_UNIT(i));
+    glBindTexture(GL_TEXTURE_2D, p->tex);
+  }
+  glViewport(0, 0, outLink->w, outLink->h);
+  glUseProgram(c->program);
+}
+
+// Uploads or imports the inputs and renders the transition into the output
+// planes, outFrame giving the output colorspace and, for hardware frames,
+// the surface to render to.
+static int draw_transition(AVFilterContext *ctx,
+                           const AVFrame *fromFrame,
+                           const AVFrame *toFrame,
+                           float progress,
+                           const AVFrame *outFrame)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *fromLink = ctx->inputs[FROM];
+  AVFilterLink *toLink = ctx->inputs[TO];
+  const AVFrame *uploadFrom = fromFrame, *uploadTo = toFrame;
+  float cspFrom[16], cspTo[16];
+  int ret;
+
+  glUseProgram(c->program);
+  if (atomic_load(&c->uniformsQueued)) {
+    update_uniforms(c);
+  }
+
+  // av_log(ctx, AV_LOG_ERROR, "transition '%s' %llu %f\n", c->source, fs->pts - c->first_pts, progress);
+  glUniform1f(c->progress, progress);
+
+  // outside of the transition only one of the inputs is visible
+  if (c->passthrough && progress <= 0.0f) {
+    uploadTo = NULL;
+  } else if (c->passthrough && progress >= 1.0f) {
+    uploadFrom = NULL;
+  }
+
+  if (c->timing) {
+    begin_stage(c, STAGE_UPLOAD);
+  }
+  if (c->hwFormat != AV_PIX_FMT_NONE &&
+      ((uploadFrom && (ret = import_hw_frame(ctx, FROM, uploadFrom)) < 0) ||
+       (uploadTo && (ret = import_hw_frame(ctx, TO, uploadTo)) < 0) ||
+       (ret = import_hw_frame(ctx, OUTPUT, outFrame)) < 0)) {
+    if (c->timing) {
+      end_stage(c);
+    }
+    return ret;
+  }
+
+  if (c->fmt->chroma) {
+    get_yuv_matrix(fromFrame, 0, cspFrom);
+    glUniformMatrix4fv(c->yuvfrom, 1, GL_FALSE, cspFrom);
+    get_yuv_matrix(toFrame, 0, cspTo);
+    glUniformMatrix4fv(c->yuvto, 1, GL_FALSE, cspTo);
+  }
+
+  if (c->hwFormat == AV_PIX_FMT_NONE) {
+    if (uploadFrom && is_uploaded(c, FROM, uploadFrom)) {
+      uploadFrom = NULL;
+    }
+    if (uploadTo && is_uploaded(c, TO, uploadTo)) {
+      uploadTo = NULL;
+    }
+  }
+  if (c->uploadBuf) {
+    stream_upload(ctx, uploadFrom, uploadTo);
+  } else if (c->hwFormat == AV_PIX_FMT_NONE) {
+    if (uploadFrom)
+      upload_frame(c, FROM, uploadFrom, fromLink->w, fromLink->h);
+    if (uploadTo)
+      upload_frame(c, TO, uploadTo, toLink->w, toLink->h);
+  }
+  if (c->hwFormat == AV_PIX_FMT_NONE) {
+    if (uploadFrom) {
+      set_uploaded(c, FROM, uploadFrom);
+    }
+    if (uploadTo) {
+      set_uploaded(c, TO, uploadTo);
+    }
+  }
+
+  if (c->timing) {
+    end_stage(c);
+    begin_stage(c, STAGE_DRAW);
+  }
+  if (c->nb_passes) {
+    draw_passes(ctx, progress, cspFrom, cspTo);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, c->fmt->chroma ? c->rgbFbo : c->outFbo);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+  if (c->prevTex) {
+    glActiveTexture(GL_TEXTURE0 + PREVIOUS_UNIT);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, ctx->outputs[0]->w, ctx->outputs[0]->h);
+  }
+
+  if (c->uploadBuf) {
+    c->uploadFences[c->uploadHead] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    c->uploadHead = (c->uploadHead + 1) % c->upload_depth;
+  }
+
+  if (c->fmt->chroma) {
+    convert_to_yuv(ctx, outFrame);
+  } else {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+  if (c->timing) {
+    end_stage(c);
+  }
+  return 0;
+}
+
+// Frees the plane of one frame of a batch, the buffer read back at once going
+// with the last of them.
+static void free_batch_region(void *opaque, uint8_t *data)
+{
+  AVBufferRef *buf = opaque;
+  av_buffer_unref(&buf);
+}
+
+// Reads the first n layers of every output plane into a buffer of the
+// batch pool, with one transfer per plane where GL_ARB_get_texture_sub_image
+// allows, and hands each queued output frame its own region of it, so that
+// they stay writable.
+static int read_batch(AVFilterContext *ctx, int n)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVBufferRef *buf = av_buffer_pool_get(c->batchPool);
+  uint8_t *planes[MAX_PLANES];
+  uint8_t *data[MAX_PLANES];
+  int p, k;
+
+  if (!buf) {
+    return AVERROR(ENOMEM);
+  }
+  for (p = 0; p < c->fmt->nb_planes; p++) {
+    planes[p] = p ? planes[p - 1] + c->batchLayerSize[p - 1] * c->batch : buf->data;
+  }
+
+#ifndef __APPLE__
+  if (GLEW_ARB_get_texture_sub_image) {
+    AVFilterLink *outLink = ctx->outputs[0];
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    for (p = 0; p < c->fmt->nb_planes; p++) {
+      const PlaneFormat *pf = &c->fmt->planes[p];
+      glPixelStorei(GL_PACK_ROW_LENGTH, c->batchLinesizes[p] / pf->bpp);
+      glGetTextureSubImage(c->planeTex[p], 0, 0, 0, 0, AV_CEIL_RSHIFT(outLink->w, pf->shift),
+                           AV_CEIL_RSHIFT(outLink->h, pf->shift), n, pf->format, pf->type,
+                           c->batchLayerSize[p] * n, planes[p]);
+    }
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+  } else
+#endif
+  {
+    // a layer at a time through the framebuffers it was drawn with
+    for (k = 0; k < n; k++) {
+      for (p = 0; p < c->fmt->nb_planes; p++) {
+        data[p] = planes[p] + c->batchLayerSize[p] * k;
+      }
+      attach_batch_layer(c, k);
+      read_output(ctx, data, c->batchLinesizes);
+    }
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+  }
+
+  for (k = 0; k < n; k++) {
+    AVFrame *out = c->batchOut[k];
+    for (p = 0; p < c->fmt->nb_planes; p++) {
+      AVBufferRef *ref = av_buffer_ref(buf);
+      out->data[p] = planes[p] + c->batchLayerSize[p] * k;
+      out->linesize[p] = c->batchLinesizes[p];
+      if (!ref || !(out->buf[p] = av_buffer_create(out->data[p], c->batchLayerSize[p], free_batch_region, ref, 0))) {
+        av_buffer_unref(&ref);
+        av_buffer_unref(&buf);
+        return AVERROR(ENOMEM);
+      }
+    }
+  }
+  av_buffer_unref(&buf);
+  return 0;
+}
+
+// Draws the queued frames into consecutive layers, reads them back at once
+// and sends them out in order.
+static int render_batch(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  int n = c->batchQueued;
+  int ret = 0, k;
+
+  make_current(c);
+  if (c->timing) {
+    collect_timings(c);
+  }
+
+  for (k = 0; k < n && ret >= 0; k++) {
+    attach_batch_layer(c, k);
+    c->drawSeq = c->batchSeq[k];
+    ret = draw_transition(ctx, c->batchFrom[k], c->batchTo[k], c->batchProgress[k], c->batchOut[k]);
+    if (ret >= 0 && c->timing) {
+      // the whole transfer is accounted to the last frame
+      begin_stage(c, STAGE_READBACK);
+      if (k == n - 1) {
+        ret = read_batch(ctx, n);
+      }
+      end_stage(c);
+      export_timings(ctx, c->batchOut[k]);
+    } else if (ret >= 0 && k == n - 1) {
+      ret = read_batch(ctx, n);
+    }
+  }
+
+  c->batchQueued = 0;
+  for (k = 0; k < n; k++) {
+    av_frame_free(&c->batchFrom[k]);
+    av_frame_free(&c->batchTo[k]);
+    if (ret >= 0) {
+      ret = emit_frame(ctx, c->batchOut[k]);
+      c->batchOut[k] = NULL;
+    } else {
+      av_frame_free(&c->batchOut[k]);
+    }
+  }
+  return ret;
+}
+
+// Keeps a frame pair for the next batch, rendering it once full.
+static int queue_batch_frame(AVFilterContext *ctx, AVFrame *fromFrame, const AVFrame *toFrame, float progress)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  int k = c->batchQueued;
+  AVFrame *out = av_frame_alloc();
+  AVFrame *to = av_frame_clone(toFrame);
+
+  if (!out || !to) {
+    av_frame_free(&out);
+    av_frame_free(&to);
+    av_frame_free(&fromFrame);
+    return AVERROR(ENOMEM);
+  }
+  av_frame_copy_props(out, fromFrame);
+  out->width = outLink->w;
+  out->height = outLink->h;
+  out->format = outLink->format;
+
+  c->batchFrom[k] = fromFrame;
+  c->batchTo[k] = to;
+  c->batchOut[k] = out;
+  c->batchProgress[k] = progress;
+  c->batchSeq[k] = c->drawSeq;
+  if (++c->batchQueued < c->batch && !c->flushAfter) {
+    return 0;
+  }
+  return render_batch(ctx);
+}
+
+// Output frames refer to the packed planes with compute=1 and to a slot of
+// the output pool, when one is free, with output_pool.
+static AVFrame *alloc_output_frame(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  AVBufferRef *ref = NULL;
+  AVFrame *frame;
+  int p;
+
+  if (!c->computeProgram && !(c->outPool && (ref = av_buffer_pool_get(c->outPool->pool)))) {
+    return ff_get_video_buffer(outLink, outLink->w, outLink->h);
+  }
+  if (!(frame = av_frame_alloc())) {
+    av_buffer_unref(&ref);
+    return NULL;
+  }
+  frame->width = outLink->w;
+  frame->height = outLink->h;
+  frame->format = outLink->format;
+  if (ref) {
+    frame->buf[0] = ref;
+    for (p = 0; p < c->fmt->nb_planes; p++) {
+      frame->data[p] = ref->data + c->packOffsets[p];
+      frame->linesize[p] = c->packLinesizes[p];
+    }
+  }
+  return frame;
+}
+
+// Whether a frame from alloc_output_frame() got a slot of the output pool.
+static int in_output_pool(const GLTransitionContext *c, const AVFrame *frame)
+{
+  const OutputPool *op = c->outPool;
+  return op && frame->data[0] >= op->ptr && frame->data[0] < op->ptr + op->slotSize * op->nb_slots;
+}
+
+// Starts reading the output into its pool slot, the frame is ready once
+// the fence is signaled.
+static GLsync read_into_pool(AVFilterContext *ctx, const AVFrame *frame)
+{
+  GLTransitionContext *c = ctx->priv;
+  uint8_t *offsets[MAX_PLANES];
+  int p;
+
+  for (p = 0; p < c->fmt->nb_planes; p++) {
+    offsets[p] = (uint8_t *)(frame->data[p] - c->outPool->ptr);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, c->outPool->buf);
+  read_output(ctx, offsets, frame->linesize);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  return glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+static int apply_transition(AVFilterContext *ctx,
+                            AVFrame *fromFrame,
+                            const AVFrame *toFrame,
+                            float progress)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *fromLink = ctx->inputs[FROM];
+  AVFilterLink *toLink = ctx->inputs[TO];
+  AVFilterLink *outLink = ctx->outputs[0];
+  AVFrame *outFrame;
+  int ret;
+
+  if (c->batch > 1) {
+    return queue_batch_frame(ctx, fromFrame, toFrame, progress);
+  }
+
+  if (!(outFrame = alloc_output_frame(ctx))) {
+    av_frame_free(&fromFrame);
+    return AVERROR(ENOMEM);
+  }
+
+  av_frame_copy_props(outFrame, fromFrame);
+
+  make_current(c);
+  if (c->timing) {
+    collect_timings(c);
+  }
+
+  if ((ret = draw_transition(ctx, fromFrame, toFrame, progress, outFrame)) < 0) {
+    av_frame_free(&outFrame);
+    av_frame_free(&fromFrame);
+    return ret;
+  }
+
+  av_log(ctx, AV_LOG_DEBUG, "linesize %d %d %d\n", fromFrame->linesize[0], toFrame->linesize[0], outFrame->linesize[0]);
+  av_log(ctx, AV_LOG_DEBUG, "frame: %dx%d %dx%d %dx%d\n", fromLink->w, fromLink->h, toLink->w, toLink->h, outLink->w, outLink->h);
+
+  av_log(ctx, AV_LOG_DEBUG, "frame2: %dx%d %dx%d %dx%d\n", fromFrame->width, fromFrame->height, toFrame->width, toFrame->height, outLink->w, outLink->h);
+
+  if (c->timing) {
+    begin_stage(c, STAGE_READBACK);
+  }
+  if (c->hwFormat != AV_PIX_FMT_NONE) {
+    if ((ret = export_hw_frame(ctx, outFrame)) < 0) {
+      if (c->timing) {
+        end_stage(c);
+      }
+      av_frame_free(&outFrame);
+      av_frame_free(&fromFrame);
+      return ret;
+    }
+  } else if (c->readback_depth > 1) {
+    // start reading this frame into the next pack buffer, or its pool slot,
+    // and only wait for the oldest one once all of them are in flight; the
+    // compute pass already wrote to the pack buffer, and frames the pool
+    // had no slot for are read at once
+    uint8_t *offsets[MAX_PLANES];
+    int p;
+
+    for (p = 0; p < c->fmt->nb_planes; p++) {
+      offsets[p] = (uint8_t *)c->packOffsets[p];
+    }
+    if (in_output_pool(c, outFrame)) {
+      c->packFences[c->packHead] = read_into_pool(ctx, outFrame);
+    } else if (c->outPool) {
+      read_output(ctx, outFrame->data, outFrame->linesize);
+    } else if (!c->computeProgram) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, c->packBufs[c->packHead]);
+      read_output(ctx, offsets, c->packLinesizes);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    if (c->packFences && !c->packFences[c->packHead]) {
+      c->packFences[c->packHead] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    if (c->timing) {
+      end_stage(c);
+      export_timings(ctx, outFrame);
+    }
+
+    c->packFrames[c->packHead] = outFrame;
+    c->packHead = (c->packHead + 1) % c->readback_depth;
+    c->packQueued++;
+    outFrame = NULL;
+  } else if (in_output_pool(c, outFrame)) {
+    GLsync fence = read_into_pool(ctx, outFrame);
+    wait_fence(&fence);
+  } else if (c->computeProgram) {
+    if ((ret = read_packed(ctx, outFrame, c->packBufs[0])) < 0) {
+      if (c->timing) {
+        end_stage(c);
+      }
+      av_frame_free(&outFrame);
+      av_frame_free(&fromFrame);
+      return ret;
+    }
+  } else {
+    read_output(ctx, outFrame->data, outFrame->linesize);
+  }
+  if (outFrame && c->timing) {
+    end_stage(c);
+    export_timings(ctx, outFrame);
+  }
+
+  av_frame_free(&fromFrame);
+
+  if (c->max_inflight && c->packQueued) {
+    return emit_finished_readbacks(ctx);
+  }
+  if (c->packQueued == c->readback_depth) {
+    return emit_oldest_readback(ctx);
+  }
+  return outFrame ? emit_frame(ctx, outFrame) : 0;
+}
+
+// Sends out the frames still queued for a batch or being read back.
+static int flush_readback(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  int ret;
+
+  if (c->batchQueued) {
+    return render_batch(ctx);
+  }
+  if (!c->packQueued) {
+    return 0;
+  }
+
+  make_current(c);
+  while (c->packQueued) {
+    if ((ret = emit_oldest_readback(ctx)) < 0) {
+      return ret;
+    }
+  }
+  return 0;
+}
+
+// Sends out the input a clamped progress resolves to as is, which is only
+// possible when it already has the output size and lives in memory, hardware
+// frames belonging to the frames context of their input. Returns 1 when done.
+static int pass_through(AVFilterContext *ctx, AVFrame *fromFrame, const AVFrame *toFrame, float progress)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  AVFilterLink *inLink = ctx->inputs[progress >= 1.0f ? TO : FROM];
+  AVFrame *outFrame = fromFrame;
+  int ret;
+
+  if (inLink->w != outLink->w || inLink->h != outLink->h || c->hwFormat != AV_PIX_FMT_NONE) {
+    return 0;
+  }
+
+  // keep output order with frames still in the readback ring
+  if ((ret = flush_readback(ctx)) < 0) {
+    av_frame_free(&fromFrame);
+    return ret;
+  }
+
+  if (progress >= 1.0f) {
+    outFrame = av_frame_clone(toFrame);
+    if (outFrame) {
+      outFrame->pts = fromFrame->pts;
+    }
+    av_frame_free(&fromFrame);
+    if (!outFrame) {
+      return AVERROR(ENOMEM);
+    }
+  }
+
+  ret = emit_frame(ctx, outFrame);
+  return ret < 0 ? ret : 1;
+}
+
+// CPU backend: the default fade and a few common gl-transitions, rendered
+// per plane in the stored sample values. 8 bit samples go through SSE2,
+// AVX2 or NEON kernels where the target has them.
+
+static float cpu_fade(float progress, float ratio, const float *uv, float *fromUV, float *toUV)
+{
+  return progress;
+}
+
+static float cpu_wipe_left(float progress, float ratio, const float *uv, float *fromUV, float *toUV)
+{
+  return progress >= 1.0f - uv[0];
+}
+
+static float cpu_wipe_right(float progress, float ratio, const float *uv, float *fromUV, float *toUV)
+{
+  return progress >= uv[0];
+}
+
+static float cpu_wipe_up(float progress, float ratio, const float *uv, float *fromUV, float *toUV)
+{
+  return progress >= uv[1];
+}
+
+static float cpu_wipe_down(float progress, float ratio, const float *uv, float *fromUV, float *toUV)
+{
+  return progress >= 1.0f - uv[1];
+}
+
+static float cpu_crosswarp(float progress, float ratio, const float *uv, float *fromUV, float *toUV)
+{
+  float x = av_clipf(progress * 2.0f + uv[0] - 1.0f, 0.0f, 1.0f);
+  int i;
+
+  x = x * x * (3.0f - 2.0f * x);
+  for (i = 0; i < 2; i++) {
+    fromUV[i] = (uv[i] - 0.5f) * (1.0f - x) + 0.5f;
+    toUV[i] = (uv[i] - 0.5f) * x + 0.5f;
+  }
+  return x;
+}
+
+#define CPU_WIPE_SOURCE(edge) \
+  "vec4 transition(vec2 uv) {\n" \
+  "  vec2 p=uv.xy/vec2(1.0).xy;\n" \
+  "  vec4 a=getFromColor(p);\n" \
+  "  vec4 b=getToColor(p);\n" \
+  "  return mix(a, b, step(" edge ",progress));\n" \
+  "}\n"
+
+static const CPUTransition cpu_transitions[] = {
+  { NULL, NULL, cpu_fade, 1, 1 },  // f_default_transition_source
+  { "fade",
+    "vec4 transition (vec2 uv) {\n"
+    "  return mix(\n"
+    "    getFromColor(uv),\n"
+    "    getToColor(uv),\n"
+    "    progress\n"
+    "  );\n"
+    "}\n", cpu_fade, 1, 1 },
+  { "wipeLeft",  CPU_WIPE_SOURCE("1.0-p.x"), cpu_wipe_left,  1, 0 },
+  { "wipeRight", CPU_WIPE_SOURCE("0.0+p.x"), cpu_wipe_right, 1, 0 },
+  { "wipeUp",    CPU_WIPE_SOURCE("0.0+p.y"), cpu_wipe_up,    1, 0 },
+  { "wipeDown",  CPU_WIPE_SOURCE("1.0-p.y"), cpu_wipe_down,  1, 0 },
+  { "crosswarp",
+    "vec4 transition(vec2 p) {\n"
+    "  float x = progress;\n"
+    "  x=smoothstep(.0,1.0,(x*2.0+p.x-1.0));\n"
+    "  return mix(getFromColor((p-.5)*(1.-x)+.5), getToColor((p-.5)*x+.5), x);\n"
+    "}\n", cpu_crosswarp, 0, 0 },
+};
+
+static const char *skip_glsl_space(const char *p, const char *end)
+{
+  while (p < end) {
+    if (av_isspace(*p)) {
+      p++;
+    } else if (end - p > 1 && p[0] == '/' && p[1] == '/') {
+      while (p < end && *p != '\n')
+        p++;
+    } else if (end - p > 1 && p[0] == '/' && p[1] == '*') {
+      for (p += 2; end - p > 1 && (p[0] != '*' || p[1] != '/'); p++);
+      p = FFMIN(p + 2, end);
+    } else {
+      break;
+    }
+  }
+  return p;
+}
+
+// Compares two GLSL sources, ignoring white space and comments like the
+// author and license lines of gl-transitions.
+static int same_glsl(const char *a, const char *a_end, const char *b, const char *b_end)
+{
+  for (;;) {
+    a = skip_glsl_space(a, a_end);
+    b = skip_glsl_space(b, b_end);
+    if (a == a_end || b == b_end) {
+      return a == a_end && b == b_end;
+    }
+    if (*a++ != *b++) {
+      return 0;
+    }
+  }
+}
+
+// Looks up the CPU version of a transition, whose source has to be the
+// stock gl-transitions one. by_name also takes an edited source named after
+// one of them, which then renders as the stock version.
+static const CPUTransition *find_cpu_transition(AVFilterContext *ctx, const char *source, int by_name)
+{
+  const char *entry = source ? strstr(source, BUNDLE_SUFFIX) : NULL;
+  const char *name = entry ? entry + strlen(BUNDLE_SUFFIX) : source ? av_basename(source) : NULL;
+  const CPUTransition *t = NULL;
+  const char *text;
+  uint8_t *data = NULL;
+  size_t size, len;
+  int i;
+
+  if (!name) {
+    return &cpu_transitions[0];
+  }
+  // bundled sources are NUL terminated in the mapping
+  if (entry) {
+    if (bundle_source(ctx, source, entry, &text) < 0) {
+      return NULL;
+    }
+    size = strlen(text);
+  } else if (av_file_map(source, &data, &size, 0, ctx) < 0) {
+    return NULL;
+  } else {
+    text = (const char *)data;
+  }
+  for (i = 1; !t && i < FF_ARRAY_ELEMS(cpu_transitions); i++) {
+    const char *glsl = cpu_transitions[i].glsl;
+    if (same_glsl(text, text + size, glsl, glsl + strlen(glsl))) {
+      t = &cpu_transitions[i];
+    }
+  }
+  if (data) {
+    av_file_unmap(data, size);
+  }
+
+  for (i = 1; !t && by_name && i < FF_ARRAY_ELEMS(cpu_transitions); i++) {
+    len = strlen(cpu_transitions[i].name);
+    if (!av_strncasecmp(name, cpu_transitions[i].name, len) &&
+        (!name[len] || !av_strcasecmp(name + len, ".glsl"))) {
+      av_log(ctx, AV_LOG_WARNING, "%s is not the stock %s transition, rendering the stock one\n",
+             source, cpu_transitions[i].name);
+      t = &cpu_transitions[i];
+    }
+  }
+  return t;
+}
+
+// k in 1/256ths, the vectors compute a * (256 - k) + b * k which gives the
+// same result in 16 bit lanes
+static void cpu_blend8_c(uint8_t *dst, const uint8_t *a, const uint8_t *b, int n, int k)
+{
+  int i;
+  for (i = 0; i < n; i++)
+    dst[i] = a[i] + (((b[i] - a[i]) * k + 128) >> 8);
+}
+
+// Bilinear fetch of a 4 byte texel from the 2x2 texels at r0 and r1, the
+// row below, in fixed point with 8 bit weights like GL samplers.
+static void cpu_fetch8x4_c(const uint8_t *r0, const uint8_t *r1, int fx, int fy, int *v)
+{
+  int k;
+  for (k = 0; k < 4; k++) {
+    int top = r0[k] * (256 - fx) + r0[k + 4] * fx;
+    int bottom = r1[k] * (256 - fx) + r1[k + 4] * fx;
+    v[k] = (top * (256 - fy) + bottom * fy + (1 << 15)) >> 16;
+  }
+}
+
+#ifdef CPU_X86_KERNELS
+TARGET("avx2")
+static void cpu_blend8_avx2(uint8_t *dst, const uint8_t *a, const uint8_t *b, int n, int k)
+{
+  const __m256i zero = _mm256_setzero_si256(), round = _mm256_set1_epi16(128);
+  const __m256i ka = _mm256_set1_epi16(256 - k), kb = _mm256_set1_epi16(k);
+  int i;
+
+  // unpacking and packing both work within 128 bit lanes, so the bytes
+  // come out in order
+  for (i = 0; i + 32 <= n; i += 32) {
+    __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+    __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(va, zero), ka),
+                                  _mm256_mullo_epi16(_mm256_unpacklo_epi8(vb, zero), kb));
+    __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(va, zero), ka),
+                                  _mm256_mullo_epi16(_mm256_unpackhi_epi8(vb, zero), kb));
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, round), 8);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, round), 8);
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(lo, hi));
+  }
+  cpu_blend8_c(dst + i, a + i, b + i, n - i, k);
+}
+
+TARGET("sse2")
+static void cpu_blend8_sse2(uint8_t *dst, const uint8_t *a, const uint8_t *b, int n, int k)
+{
+  const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi16(128);
+  const __m128i ka = _mm_set1_epi16(256 - k), kb = _mm_set1_epi16(k);
+  int i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), ka),
+                               _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), kb));
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), ka),
+                               _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), kb));
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+  }
+  cpu_blend8_c(dst + i, a + i, b + i, n - i, k);
+}
+
+// both texels of a row in one load, up to 65280 per lane horizontally and
+// 32 bit products vertically
+TARGET("sse2")
+static void cpu_fetch8x4_sse2(const uint8_t *r0, const uint8_t *r1, int fx, int fy, int *v)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i wx = _mm_unpacklo_epi64(_mm_set1_epi16(256 - fx), _mm_set1_epi16(fx));
+  __m128i wy = _mm_unpacklo_epi64(_mm_set1_epi16(256 - fy), _mm_set1_epi16(fy));
+  __m128i top = _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)r0), zero), wx);
+  __m128i bottom = _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)r1), zero), wx);
+  __m128i rows = _mm_unpacklo_epi64(_mm_add_epi16(top, _mm_srli_si128(top, 8)),
+                                    _mm_add_epi16(bottom, _mm_srli_si128(bottom, 8)));
+  __m128i lo = _mm_mullo_epi16(rows, wy), hi = _mm_mulhi_epu16(rows, wy);
+  __m128i sum = _mm_add_epi32(_mm_unpacklo_epi16(lo, hi), _mm_unpackhi_epi16(lo, hi));
+  sum = _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(1 << 15)), 16);
+  _mm_storeu_si128((__m128i *)v, sum);
+}
+#endif
+
+#ifdef CPU_NEON_KERNELS
+static void cpu_blend8_neon(uint8_t *dst, const uint8_t *a, const uint8_t *b, int n, int k)
+{
+  const uint16x8_t ka = vdupq_n_u16(256 - k), kb = vdupq_n_u16(k);
+  int i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    uint8x16_t va = vld1q_u8(a + i), vb = vld1q_u8(b + i);
+    uint16x8_t lo = vmlaq_u16(vmulq_u16(vmovl_u8(vget_low_u8(va)), ka), vmovl_u8(vget_low_u8(vb)), kb);
+    uint16x8_t hi = vmlaq_u16(vmulq_u16(vmovl_u8(vget_high_u8(va)), ka), vmovl_u8(vget_high_u8(vb)), kb);
+    vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+  }
+  cpu_blend8_c(dst + i, a + i, b + i, n - i, k);
+}
+
+static void cpu_fetch8x4_neon(const uint8_t *r0, const uint8_t *r1, int fx, int fy, int *v)
+{
+  uint16x8_t wx = vcombine_u16(vdup_n_u16(256 - fx), vdup_n_u16(fx));
+  uint16x8_t top = vmulq_u16(vmovl_u8(vld1_u8(r0)), wx);
+  uint16x8_t bottom = vmulq_u16(vmovl_u8(vld1_u8(r1)), wx);
+  uint32x4_t sum = vmull_n_u16(vadd_u16(vget_low_u16(top), vget_high_u16(top)), 256 - fy);
+  sum = vmlal_n_u16(sum, vadd_u16(vget_low_u16(bottom), vget_high_u16(bottom)), fy);
+  vst1q_s32(v, vreinterpretq_s32_u32(vrshrq_n_u32(sum, 16)));
+}
+#endif
+
+static int config_cpu(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  float ratio = outLink->w / (float)outLink->h;
+#if defined(CPU_X86_KERNELS) || defined(CPU_NEON_KERNELS)
+  int flags = av_get_cpu_flags();
+#endif
+  int i;
+
+  if (c->hwFormat != AV_PIX_FMT_NONE) {
+    av_log(ctx, AV_LOG_ERROR, "the CPU backend needs frames in memory\n");
+    return AVERROR(ENOSYS);
+  }
+  if (c->transitions || !(c->cpu = find_cpu_transition(ctx, c->source, c->backend == BACKEND_CPU))) {
+    av_log(ctx, AV_LOG_ERROR, "no CPU version of transition %s\n", c->source);
+    return AVERROR(ENOSYS);
+  }
+  // samples are blended as whole bytes or shorts
+  if (c->fmt->planes[0].type == GL_UNSIGNED_INT_2_10_10_10_REV) {
+    av_log(ctx, AV_LOG_ERROR, "the CPU backend doesn't support %s\n", av_get_pix_fmt_name(c->fmt->pix_fmt));
+    return AVERROR(ENOSYS);
+  }
+  // the CPU versions have no parameters
+  if (c->uniforms) {
+    av_log(ctx, AV_LOG_ERROR, "uniforms are not supported on the CPU\n");
+    return AVERROR(ENOSYS);
+  }
+  if (c->readback_depth > 1 || c->upload_depth > 1 || c->batch > 1 || c->timing || c->prescale || c->compute) {
+    av_log(ctx, AV_LOG_WARNING, "readback_depth, upload_depth, max_inflight, batch, timing, prescale and compute have no effect on the CPU\n");
+    c->readback_depth = c->upload_depth = c->batch = 1;
+    c->max_inflight = 0;
+    c->timing = c->prescale = c->compute = 0;
+  }
+  for (i = FROM; i <= TO; i++) {
+    get_matrix(c->resize, c->cpuMatrix[i], ratio, ctx->inputs[i]->w / (float)ctx->inputs[i]->h);
+  }
+  c->cpuBlend8 = cpu_blend8_c;
+  c->cpuFetch8x4 = cpu_fetch8x4_c;
+#if defined(CPU_X86_KERNELS)
+  if (flags & AV_CPU_FLAG_SSE2) {
+    c->cpuBlend8 = cpu_blend8_sse2;
+    c->cpuFetch8x4 = cpu_fetch8x4_sse2;
+  }
+  if (flags & AV_CPU_FLAG_AVX2) {
+    c->cpuBlend8 = cpu_blend8_avx2;
+  }
+#elif defined(CPU_NEON_KERNELS)
+  if (flags & AV_CPU_FLAG_NEON) {
+    c->cpuBlend8 = cpu_blend8_neon;
+    c->cpuFetch8x4 = cpu_fetch8x4_neon;
+  }
+#endif
+  av_log(ctx, AV_LOG_VERBOSE, "rendering %s on the CPU\n", c->cpu->name ? c->cpu->name : "fade");
+  return 0;
+}
+
+typedef struct {
+  const AVFrame *in[2];
+  AVFrame *out;
+  float progress;
+} CPUThreadData;
+
+// k in 1/32768ths, (b - a) * k still fits in an int
+static void cpu_blend16(uint16_t *dst, const uint16_t *a, const uint16_t *b, int n, int k)
+{
+  int i;
+  for (i = 0; i < n; i++)
+    dst[i] = a[i] + (((b[i] - a[i]) * k + (1 << 14)) >> 15);
+}
+
+// Value outside of an input, the black the GL path gets from the border
+// and from the YUV samplers.
+static int cpu_border(const GLTransitionContext *c, const AVFrame *frame, int plane, int bytes)
+{
+  int shift = (bytes - 1) * 8;
+  if (!c->fmt->chroma) {
+    return 0;
+  }
+  if (plane) {
+    return 128 << shift;
+  }
+  return frame->color_range == AVCOL_RANGE_JPEG ? 0 : 16 << shift;
+}
+
+// Bilinear fetch of component comp at texture coordinates st, like a
+// GL_LINEAR sampler with GL_CLAMP_TO_BORDER.
+static float cpu_sample(const uint8_t *data, int linesize, int w, int h, int bytes, int nc, int comp,
+                        int border, float s, float t)
+{
+  float x = s * w - 0.5f, y = t * h - 0.5f;
+  int x0 = floorf(x), y0 = floorf(y);
+  float fx = x - x0, fy = y - y0, v[4];
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    int xi = x0 + (i & 1), yi = y0 + (i >> 1);
+    if (xi < 0 || yi < 0 || xi >= w || yi >= h) {
+      v[i] = border;
+    } else if (bytes == 1) {
+      v[i] = data[yi * linesize + xi * nc + comp];
+    } else {
+      v[i] = ((const uint16_t *)(data + yi * linesize))[xi * nc + comp];
+    }
+  }
+  return (v[0] * (1 - fx) + v[1] * fx) * (1 - fy) + (v[2] * (1 - fx) + v[3] * fx) * fy;
+}
+
+// Bilinear fetch of all the components of an 8 bit plane at texture
+// coordinates st, in fixed point with 8 bit weights like GL samplers.
+static void cpu_sample8(const GLTransitionContext *c, const uint8_t *data, int linesize,
+                        int w, int h, int nc, int border, float s, float t, int *v)
+{
+  float x = s * w - 0.5f, y = t * h - 0.5f;
+  int x0 = floorf(x), y0 = floorf(y);
+  int fx = lrintf((x - x0) * 256), fy = lrintf((y - y0) * 256);
+  int i, k, tap[4];
+
+  if (x0 >= 0 && y0 >= 0 && x0 + 1 < w && y0 + 1 < h) {
+    const uint8_t *r0 = data + y0 * linesize + x0 * nc, *r1 = r0 + linesize;
+    if (nc == 4) {
+      c->cpuFetch8x4(r0, r1, fx, fy, v);
+      return;
+    }
+    for (k = 0; k < nc; k++) {
+      int top = r0[k] * (256 - fx) + r0[k + nc] * fx;
+      int bottom = r1[k] * (256 - fx) + r1[k + nc] * fx;
+      v[k] = (top * (256 - fy) + bottom * fy + (1 << 15)) >> 16;
+    }
+    return;
+  }
+
+  // texels outside of the plane are the border, like GL_CLAMP_TO_BORDER
+  for (k = 0; k < nc; k++) {
+    for (i = 0; i < 4; i++) {
+      int xi = x0 + (i & 1), yi = y0 + (i >> 1);
+      tap[i] = xi < 0 || yi < 0 || xi >= w || yi >= h ? border : data[yi * linesize + xi * nc + k];
+    }
+    v[k] = ((tap[0] * (256 - fx) + tap[1] * fx) * (256 - fy) +
+            (tap[2] * (256 - fx) + tap[3] * fx) * fy + (1 << 15)) >> 16;
+  }
+}
+
+static int cpu_slice(AVFilterContext *ctx, void *arg, int job, int nb_jobs)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  const CPUThreadData *td = arg;
+  const CPUTransition *t = c->cpu;
+  float ratio = outLink->w / (float)outLink->h;
+  int p, x, y, i, k;
+
+  for (p = 0; p < c->fmt->nb_planes; p++) {
+    const PlaneFormat *pf = &c->fmt->planes[p];
+    int bytes = pf->type == GL_UNSIGNED_SHORT ? 2 : 1;
+    int nc = pf->bpp / bytes, one = bytes == 1 ? 256 : 1 << 15;
+    int w = AV_CEIL_RSHIFT(outLink->w, pf->shift), h = AV_CEIL_RSHIFT(outLink->h, pf->shift);
+    int start = h * job / nb_jobs, end = h * (job + 1) / nb_jobs;
+    int iw[2], ih[2], border[2];
+    // inputs of the output size are sampled at the output pixels
+    int direct = t->sameUV;
+
+    for (i = FROM; i <= TO; i++) {
+      iw[i] = AV_CEIL_RSHIFT(ctx->inputs[i]->w, pf->shift);
+      ih[i] = AV_CEIL_RSHIFT(ctx->inputs[i]->h, pf->shift);
+      border[i] = cpu_border(c, td->in[i], p, bytes);
+      direct &= iw[i] == w && ih[i] == h;
+    }
+
+    for (y = start; y < end; y++) {
+      uint8_t *dst = td->out->data[p] + y * td->out->linesize[p];
+      const uint8_t *a = td->in[FROM]->data[p] + y * td->in[FROM]->linesize[p];
+      const uint8_t *b = td->in[TO]->data[p] + y * td->in[TO]->linesize[p];
+      float uv[2], st[2][2];
+
+      // gl-transitions have uv.y pointing up, from the last row
+      uv[1] = 1.0f - (y + 0.5f) / h;
+      if (direct && t->uniform) {
+        k = lrintf(t->kernel(td->progress, ratio, uv, st[FROM], st[TO]) * one);
+        if (bytes == 1)
+          c->cpuBlend8(dst, a, b, w * nc, k);
+        else
+          cpu_blend16((uint16_t *)dst, (const uint16_t *)a, (const uint16_t *)b, w * nc, k);
+        continue;
+      }
+
+      for (x = 0; x < w; x++) {
+        float weight;
+        uv[0] = (x + 0.5f) / w;
+        st[FROM][0] = st[TO][0] = uv[0];
+        st[FROM][1] = st[TO][1] = uv[1];
+        weight = t->kernel(td->progress, ratio, uv, st[FROM], st[TO]);
+
+        if (direct) {
+          k = lrintf(weight * one);
+          if (bytes == 1)
+            cpu_blend8_c(dst + x * nc, a + x * nc, b + x * nc, nc, k);
+          else
+            cpu_blend16((uint16_t *)dst + x * nc, (const uint16_t *)a + x * nc, (const uint16_t *)b + x * nc, nc, k);
+          continue;
+        }
+
+        if (bytes == 1) {
+          int v8[2][4];
+          for (i = FROM; i <= TO; i++) {
+            const float *m = c->cpuMatrix[i];
+            cpu_sample8(c, td->in[i]->data[p], td->in[i]->linesize[p], iw[i], ih[i], nc, border[i],
+                        m[0] * st[i][0] + m[1] * st[i][1] + m[2], m[3] * st[i][0] + m[4] * st[i][1] + m[5],
+                        v8[i]);
+          }
+          k = lrintf(weight * 256);
+          for (i = 0; i < nc; i++)
+            dst[x * nc + i] = v8[FROM][i] + (((v8[TO][i] - v8[FROM][i]) * k + 128) >> 8);
+          continue;
+        }
+
+        for (k = 0; k < nc; k++) {
+          float v[2];
+          for (i = FROM; i <= TO; i++) {
+            // mfrom and mto as applied to vec3(uv, 1.) in the GLSL samplers
+            const float *m = c->cpuMatrix[i];
+            float s = m[0] * st[i][0] + m[1] * st[i][1] + m[2];
+            float tt = m[3] * st[i][0] + m[4] * st[i][1] + m[5];
+            v[i] = cpu_sample(td->in[i]->data[p], td->in[i]->linesize[p], iw[i], ih[i],
+                              bytes, nc, k, border[i], s, tt);
+          }
+          v[FROM] += (v[TO] - v[FROM]) * weight;
+          if (bytes == 1)
+            dst[x * nc + k] = av_clip_uint8(lrintf(v[FROM]));
+          else
+            ((uint16_t *)dst)[x * nc + k] = av_clip_uint16(lrintf(v[FROM]));
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+static int cpu_transition(AVFilterContext *ctx, AVFrame *fromFrame, const AVFrame *toFrame, float progress)
+{
+  AVFilterLink *outLink = ctx->outputs[0];
+  CPUThreadData td;
+
+  td.out = ff_get_video_buffer(outLink, outLink->w, outLink->h);
+  if (!td.out) {
+    av_frame_free(&fromFrame);
+    return AVERROR(ENOMEM);
+  }
+  av_frame_copy_props(td.out, fromFrame);
+  td.in[FROM] = fromFrame;
+  td.in[TO] = toFrame;
+  td.progress = progress;
+
+  ctx->internal->execute(ctx, cpu_slice, &td, NULL,
+                         FFMIN(outLink->h, ff_filter_get_nb_threads(ctx)));
+  av_frame_free(&fromFrame);
+  return emit_frame(ctx, td.out);
+}
+
+// Renders or forwards a frame of the first input at the given progress,
+// on the render thread with render_thread=1.
+static int render_frame(AVFilterContext *ctx, AVFrame *fromFrame, const AVFrame *toFrame, float progress)
+{
+  GLTransitionContext *c = ctx->priv;
+  int ret;
+
+  c->blendStart = av_gettime_relative();
+  if (!toFrame) {
+    // keep output order with frames still in the readback ring
+    if ((ret = flush_readback(ctx)) < 0) {
+      av_frame_free(&fromFrame);
+      return ret;
+    }
+    return emit_frame(ctx, fromFrame);
+  }
+
+  if (c->passthrough && (progress <= 0.0f || progress >= 1.0f)) {
+    if ((ret = pass_through(ctx, fromFrame, toFrame, progress)) != 0) {
+      return FFMIN(ret, 0);
+    }
+  }
+
+  if (c->cpu) {
+    return cpu_transition(ctx, fromFrame, toFrame, progress);
+  }
+  return apply_transition(ctx, fromFrame, toFrame, progress);
+}
+
+// Queues a job for the render thread, fails when the ring is full.
+static int push_render_job(GLTransitionContext *c, const RenderJob *job)
+{
+  atomic_fetch_add(&c->renderPending, 1);
+  if (!ring_push(&c->jobs, job)) {
+    atomic_fetch_sub(&c->renderPending, 1);
+    return 0;
+  }
+  wake_peer(c, &c->renderSleeping);
+  return 1;
+}
+
+// Sends out the frames the render thread has finished, returns how many or
+// the error it stopped on.
+static int drain_render_thread(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  RenderJob out;
+  int ret, n = 0;
+
+  while (ring_pop(&c->done, &out)) {
+    c->renderReturned++;
+    if ((ret = ff_filter_frame(ctx->outputs[0], out.frame)) < 0) {
+      return ret;
+    }
+    n++;
+  }
+  ret = atomic_load(&c->renderError);
+  return ret < 0 ? ret : n;
+}
+
+// activate() takes no new frames while the job ring is full or the done
+// ring would not take all the frames with the thread.
+static int render_thread_full(GLTransitionContext *c)
+{
+  return ring_count(&c->jobs) == c->jobs.size || c->renderTaken - c->renderReturned >= c->done.size;
+}
+
+// Sleeps until the render thread sends a frame back or takes a job, once
+// the queue is at its bound.
+static void wait_render_thread(GLTransitionContext *c)
+{
+  ff_mutex_lock(&c->renderLock);
+  prepare_sleep(&c->graphSleeping);
+  while (!ring_count(&c->done) && render_thread_full(c)) {
+    ff_cond_wait(&c->renderCond, &c->renderLock);
+  }
+  atomic_store_explicit(&c->graphSleeping, 0, memory_order_relaxed);
+  ff_mutex_unlock(&c->renderLock);
+}
+
+// Has the render thread flush what it holds and sends out everything it
+// rendered.
+static int finish_render_thread(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  RenderJob flush = { NULL };
+  int queued = 0, ret;
+
+  for (;;) {
+    if ((ret = drain_render_thread(ctx)) < 0) {
+      return ret;
+    }
+    if (!queued) {
+      queued = push_render_job(c, &flush);
+    }
+    ff_mutex_lock(&c->renderLock);
+    prepare_sleep(&c->graphSleeping);
+    if (queued && !atomic_load(&c->renderPending) && !ring_count(&c->done)) {
+      atomic_store_explicit(&c->graphSleeping, 0, memory_order_relaxed);
+      ff_mutex_unlock(&c->renderLock);
+      return 0;
+    }
+    if (!ring_count(&c->done)) {
+      ff_cond_wait(&c->renderCond, &c->renderLock);
+    }
+    atomic_store_explicit(&c->graphSleeping, 0, memory_order_relaxed);
+    ff_mutex_unlock(&c->renderLock);
+  }
+}
+
+#if HAVE_THREADS
+static void *render_thread(void *arg)
+{
+  AVFilterContext *ctx = arg;
+  GLTransitionContext *c = ctx->priv;
+  RenderJob job;
+  int ret = 0, exiting;
+
+  make_current(c);
+  for (;;) {
+    // with max_inflight, an idle thread sends out its readbacks as the GPU
+    // finishes them rather than with the next job
+    if (ret >= 0 && c->max_inflight && c->packQueued && !ring_count(&c->jobs)) {
+      if ((ret = emit_oldest_readback(ctx)) < 0) {
+        atomic_store(&c->renderError, ret);
+      }
+      continue;
+    }
+    ff_mutex_lock(&c->renderLock);
+    prepare_sleep(&c->renderSleeping);
+    while (!ring_count(&c->jobs) && !c->renderExit) {
+      ff_cond_wait(&c->renderCond, &c->renderLock);
+    }
+    atomic_store_explicit(&c->renderSleeping, 0, memory_order_relaxed);
+    exiting = c->renderExit;
+    ff_mutex_unlock(&c->renderLock);
+    if (!ring_pop(&c->jobs, &job)) {
+      break;
+    }
+
+    // after an error or once uninit() is waiting, jobs are only dropped
+    if (ret >= 0 && exiting) {
+      ret = AVERROR_EXIT;
+    }
+    if (ret >= 0) {
+      c->drawSeq = job.seq;
+      c->flushAfter = job.flush;
+      ret = job.frame ? render_frame(ctx, job.frame, job.to, job.progress) : flush_readback(ctx);
+      if (ret < 0 && ret != AVERROR_EXIT) {
+        atomic_store(&c->renderError, ret);
+      }
+    } else {
+      av_frame_free(&job.frame);
+    }
+    av_frame_free(&job.to);
+    atomic_fetch_sub(&c->renderPending, 1);
+    wake_peer(c, &c->graphSleeping);
+  }
+  // for uninit() to make it current again
+  release_current(c);
+  return NULL;
+}
+
+static int start_render_thread(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  int ret;
+
+  if (c->cpu || c->hwFormat != AV_PIX_FMT_NONE) {
+    av_log(ctx, AV_LOG_WARNING, "render_thread has no effect on the CPU backend and hardware frames\n");
+    return 0;
+  }
+
+  // the done ring takes what the thread holds besides the queued jobs, so
+  // the thread never waits for activate()
+  if ((ret = ring_init(&c->jobs, RENDER_QUEUE)) < 0 ||
+      (ret = ring_init(&c->done, RENDER_QUEUE + c->readback_depth + c->batch)) < 0) {
+    av_freep(&c->jobs.slots);
+    return ret;
+  }
+  ff_mutex_init(&c->renderLock, NULL);
+  ff_cond_init(&c->renderCond, NULL);
+  // a context is current on a single thread at a time
+  release_current(c);
+  c->renderRunning = 1;
+  if ((ret = pthread_create(&c->renderThread, NULL, render_thread, ctx))) {
+    c->renderRunning = 0;
+    make_current(c);
+    ff_cond_destroy(&c->renderCond);
+    ff_mutex_destroy(&c->renderLock);
+    av_freep(&c->jobs.slots);
+    av_freep(&c->done.slots);
+    av_log(ctx, AV_LOG_ERROR, "creating render thread failed\n");
+    return AVERROR(ret);
+  }
+  return 0;
+}
+
+static void stop_render_thread(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  RenderJob out;
+
+  ff_mutex_lock(&c->renderLock);
+  c->renderExit = 1;
+  ff_cond_broadcast(&c->renderCond);
+  ff_mutex_unlock(&c->renderLock);
+  pthread_join(c->renderThread, NULL);
+
+  while (ring_pop(&c->done, &out)) {
+    av_frame_free(&out.frame);
+  }
+  ff_cond_destroy(&c->renderCond);
+  ff_mutex_destroy(&c->renderLock);
+  av_freep(&c->jobs.slots);
+  av_freep(&c->done.slots);
+  c->renderRunning = 0;
+}
+#else
+static int start_render_thread(AVFilterContext *ctx)
+{
+  av_log(ctx, AV_LOG_WARNING, "render_thread needs a build with threads\n");
+  return 0;
+}
+#endif
+
+// lead_time scheduling, which needs config_gl() and comes after it
+static void release_frame_resources(AVFilterContext *ctx);
+static void start_warm_up(AVFilterContext *ctx);
+static int finish_warm_up(AVFilterContext *ctx);
+static int schedule_resources(AVFilterContext *ctx, FFFrameSync *fs, float progress);
+
+static int blend_frame(FFFrameSync *fs)
+{
+  AVFilterContext *ctx = fs->parent;
+  GLTransitionContext *c = ctx->priv;
+
+  AVFrame *fromFrame, *toFrame;
+  float progress = 0.0f;
+  int flush = 0;
+  int ret;
+
+  ret = ff_framesync_dualinput_get(fs, &fromFrame, &toFrame);
+  if (ret < 0) {
+    return ret;
+  }
+
+  if (c->first_pts == AV_NOPTS_VALUE && fromFrame && fromFrame->pts != AV_NOPTS_VALUE) {
+    c->first_pts = fromFrame->pts;
+  }
+  if (toFrame) {
+    progress = get_progress(ctx, fs);
+    if (c->lead_time >= 0.0 && (ret = schedule_resources(ctx, fs, progress)) < 0) {
+      av_frame_free(&fromFrame);
+      return ret;
+    }
+    // with passthrough the batch would only go out with the next frame
+    flush = c->resources == RESOURCES_READY && c->passthrough && c->batch > 1 && last_in_window(ctx, fs);
+  }
+
+  if (c->renderRunning) {
+    RenderJob job = { fromFrame, NULL, progress, c->uniformSeq, flush };
+    if (toFrame && !(job.to = av_frame_clone(toFrame))) {
+      av_frame_free(&fromFrame);
+      return AVERROR(ENOMEM);
+    }
+    // activate() only gets here with room in the ring
+    if (!push_render_job(c, &job)) {
+      av_frame_free(&job.frame);
+      av_frame_free(&job.to);
+      return AVERROR_BUG;
+    }
+    c->renderTaken++;
+    return 0;
+  }
+  c->drawSeq = c->uniformSeq;
+  c->flushAfter = flush;
+  return render_frame(ctx, fromFrame, toFrame, progress);
+}
+
+// Builds the program of every transition of the timeline or preloaded
+// source, leaving the first one in use.
+static int build_transition_programs(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  int i, ret;
+
+  for (i = c->nb_transitions - 1; i >= 0; i--) {
+    TimelineTransition *t = &c->transitions[i];
+    if ((ret = build_program(ctx, t->source)) < 0) {
+      return ret;
+    }
+    t->program = c->program;
+    glUseProgram(t->program);
+    if ((ret = init_uniforms(ctx)) < 0 || (ret = init_runtime_uniforms(ctx)) < 0) {
+      return ret;
+    }
+    t->progress = c->progress;
+    t->yuvfrom = c->yuvfrom;
+    t->yuvto = c->yuvto;
+    t->uniformTable = c->uniformTable;
+    t->uniformLocs = c->uniformLocs;
+    t->passes = c->passes;
+    t->nb_passes = c->nb_passes;
+    c->uniformLocs = NULL;
+    c->passes = NULL;
+  }
+  return 0;
+}
+
+// Takes the next '|' separated item of *list, NULL when empty or once the
+// list runs out.
+static int list_item(const char **list, char **item)
+{
+  size_t len;
+
+  *item = NULL;
+  if (!*list) {
+    return 0;
+  }
+  len = strcspn(*list, "|");
+  if (len && !(*item = av_strndup(*list, len))) {
+    return AVERROR(ENOMEM);
+  }
+  *list = (*list)[len] ? *list + len + 1 : NULL;
+  return 0;
+}
+
+static av_cold int init(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  const char *sources = c->sources;
+  int i, ret;
+
+  c->fs.on_event = blend_frame;
+  c->first_pts = AV_NOPTS_VALUE;
+  c->windowOffset = c->windowDuration = -1.0;
+  c->hwFormat = AV_PIX_FMT_NONE;
+
+  // gltimeline lists the transitions between its clips itself
+  if (c->nb_clips || !sources) {
+    return 0;
+  }
+  if (c->source) {
+    av_log(ctx, AV_LOG_ERROR, "source and sources are exclusive\n");
+    return AVERROR(EINVAL);
+  }
+  c->nb_transitions = 1;
+  for (i = 0; sources[i]; i++) {
+    c->nb_transitions += sources[i] == '|';
+  }
+  if (!(c->transitions = av_calloc(c->nb_transitions, sizeof(*c->transitions)))) {
+    return AVERROR(ENOMEM);
+  }
+  for (i = 0; i < c->nb_transitions; i++) {
+    if ((ret = list_item(&sources, &c->transitions[i].source)) < 0) {
+      return ret;
+    }
+  }
+  return 0;
+}
+
+static av_cold void uninit(AVFilterContext *ctx) {
+  GLTransitionContext *c = ctx->priv;
+  int i;
+#if HAVE_THREADS
+  if (c->renderRunning) {
+    stop_render_thread(ctx);
+  }
+  if (c->warmRunning) {
+    pthread_join(c->warmThread, NULL);
+  }
+#endif
+  ff_framesync_uninit(&c->fs);
+
+  // other instances may have left their context current
+  if (has_context(c)) {
+    make_current(c);
+  }
+
+  if (c->timing) {
+    if (c->timerQueries[0][0]) {
+      glFinish();
+      collect_timings(c);
+      glDeleteQueries(TIMER_DEPTH * GPU_STAGES, c->timerQueries[0]);
+    }
+    log_timing_summary(ctx);
+    for (i = 0; i < NB_STAGES; i++)
+      av_freep(&c->timingSamples[i]);
+  }
+
+#ifdef GL_TRANSITION_HWMAP_CUDA
+  if (c->cuda) {
+    CudaFunctions *cu = c->cuda->internal->cuda_dl;
+    CUcontext dummy;
+    int p;
+    if (CHECK_CU(cu->cuCtxPushCurrent(c->cuda->cuda_ctx)) >= 0) {
+      for (i = FROM; i <= OUTPUT; i++)
+        for (p = 0; p < MAX_PLANES; p++)
+          if (c->cuRes[i][p])
+            CHECK_CU(cu->cuGraphicsUnregisterResource(c->cuRes[i][p]));
+      CHECK_CU(cu->cuCtxPopCurrent(&dummy));
+    }
+  }
+#endif
+
+  release_frame_resources(ctx);
+  if (c->posBuf)
+    glDeleteBuffers(1, &c->posBuf);
+  if (c->transitions) {
+    // c->program and c->uniformLocs are those of one of them
+    for (i = 0; i < c->nb_transitions; i++) {
+      if (c->transitions[i].program)
+        glDeleteProgram(c->transitions[i].program);
+      av_freep(&c->transitions[i].source);
+      av_freep(&c->transitions[i].uniformLocs);
+      free_passes(&c->transitions[i].passes, c->transitions[i].nb_passes);
+    }
+    c->program = 0;
+    c->uniformLocs = NULL;
+    c->passes = NULL;
+  }
+  if (c->program)
+    glDeleteProgram(c->program);
+  free_passes(&c->passes, c->nb_passes);
+  av_freep(&c->uniformLocs);
+  av_freep(&c->uniformUpdates);
+  release_bundles(c);
+#ifdef GL_TRANSITION_HWMAP_DRM
+  for (i = 0; i < FF_ARRAY_ELEMS(c->drmFrames); i++)
+    av_frame_free(&c->drmFrames[i]);
+#endif
+  
 #ifdef GL_TRANSITION_USING_EGL
-  eglMakeCurrent(c->eglDpy, c->eglSurf, c->eglSurf, c->eglCtx);
+  if (c->eglCtx) {
+    eglMakeCurrent(c->eglDpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(c->eglDpy, c->eglCtx);
+  }
+  if (c->eglSurf) {
+    eglDestroySurface(c->eglDpy, c->eglSurf);
+  }
 #else
-  glfwMakeContextCurrent(c->window);
+  if (c->window) {
+    glfwDestroyWindow(c->window);
+  }
 #endif
+  release_device(&c->device);
 
-  glUseProgram(c->program);
+  if (c->f_shader_source) {
+    av_freep(&c->f_shader_source);
+  }
 
-  ts = ((fs->pts - c->first_pts) / (float)fs->time_base.den) - c->offset;
-  progress = FFMAX(0.0f, FFMIN(1.0f, ts / c->duration));
-  // av_log(ctx, AV_LOG_ERROR, "transition '%s' %llu %f %f\n", c->source, fs->pts - c->first_pts, ts, progress);
-  glUniform1f(c->progress, progress);
+  av_freep(&c->transitions);
+  if (c->nb_clips) {
+    for (i = 0; i < ctx->nb_inputs; i++)
+      av_freep(&ctx->input_pads[i].name);
+    av_freep(&c->clipShift);
+    av_freep(&c->clipEof);
+    av_frame_free(&c->pending);
+    av_frame_free(&c->last);
+    av_frame_free(&c->toCur);
+    av_frame_free(&c->toNext);
+  }
+}
 
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, c->from);
-  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-  glPixelStorei(GL_UNPACK_ROW_LENGTH, fromFrame->linesize[0]/3);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, fromLink->w, fromLink->h, 0, PIXEL_FORMAT, GL_UNSIGNED_BYTE, fromFrame->data[0]);
-  
-  glActiveTexture(GL_TEXTURE0 + 1);
-  glBindTexture(GL_TEXTURE_2D, c->to);
-  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-  glPixelStorei(GL_UNPACK_ROW_LENGTH, toFrame->linesize[0]/3);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, toLink->w, toLink->h, 0, PIXEL_FORMAT, GL_UNSIGNED_BYTE, toFrame->data[0]);
+// Queues a uniform value or transition switch for the frames that follow.
+static int queue_update(GLTransitionContext *c, int index, int transition, const UniformValue *v)
+{
+  UniformUpdate *u;
 
-  glDrawArrays(GL_TRIANGLES, 0, 6);
-  glPixelStorei(GL_PACK_ALIGNMENT, 1);
-  glPixelStorei(GL_PACK_ROW_LENGTH, outFrame->linesize[0]/3);
-  glReadPixels(0, 0, outLink->w, outLink->h, PIXEL_FORMAT, GL_UNSIGNED_BYTE, outFrame->data[0]);
+  if (c->renderRunning) {
+    ff_mutex_lock(&c->renderLock);
+  }
+  if ((u = av_dynarray2_add((void **)&c->uniformUpdates, &c->nbUniformUpdates, sizeof(*u), NULL))) {
+    u->seq = ++c->uniformSeq;
+    u->index = index;
+    u->transition = transition;
+    if (v) {
+      u->value = *v;
+    }
+    atomic_fetch_add(&c->uniformsQueued, 1);
+  }
+  if (c->renderRunning) {
+    ff_mutex_unlock(&c->renderLock);
+  }
+  return u ? 0 : AVERROR(ENOMEM);
+}
 
+static int queue_uniform(AVFilterContext *ctx, const char *name, const char *value)
+{
+  GLTransitionContext *c = ctx->priv;
+  // the table of the source selected last, the frames drawn may be behind
+  const UniformTable *t = c->transitions ? c->transitions[c->selected].uniformTable : c->uniformTable;
+  UniformValue v;
+  int i;
 
-  av_log(ctx, AV_LOG_DEBUG, "linesize %d %d %d\n", fromFrame->linesize[0], toFrame->linesize[0], outFrame->linesize[0]);
-  av_log(ctx, AV_LOG_DEBUG, "frame: %dx%d %dx%d %dx%d\n", fromLink->w, fromLink->h, toLink->w, toLink->h, outLink->w, outLink->h);
+  for (i = 0; t && i < t->nb_uniforms && !streq(t->uniforms[i].name, name); i++);
+  if (!t || i == t->nb_uniforms) {
+    av_log(ctx, AV_LOG_ERROR, "the transition has no uniform named %s\n", name);
+    return AVERROR(EINVAL);
+  }
+  if (parse_uniform_value(t->uniforms[i].type, value, &v) < 0) {
+    av_log(ctx, AV_LOG_ERROR, "parsing %s %s for uniform %s\n", t->uniforms[i].type->name, value, name);
+    return AVERROR(EINVAL);
+  }
+  return queue_update(c, i, 0, &v);
+}
 
-  av_log(ctx, AV_LOG_DEBUG, "frame2: %dx%d %dx%d %dx%d\n", fromFrame->width, fromFrame->height, toFrame->width, toFrame->height, outFrame->width, outFrame->height);  
-  
-  av_frame_free(&fromFrame);
+// Selects the preloaded source a trigger argument names, by index or path.
+static int select_transition(AVFilterContext *ctx, const char *arg)
+{
+  GLTransitionContext *c = ctx->priv;
+  char *end;
+  int i = strtol(arg, &end, 10);
+
+  if (*end || end == arg) {
+    for (i = 0; i < c->nb_transitions && !streq(c->transitions[i].source, arg); i++);
+  }
+  if (!c->transitions || i < 0 || i >= c->nb_transitions) {
+    av_log(ctx, AV_LOG_ERROR, "no preloaded source %s\n", arg);
+    return AVERROR(EINVAL);
+  }
+  if (i == c->selected) {
+    return 0;
+  }
+  c->selected = i;
+  return queue_update(c, -1, i, NULL);
+}
+
+// progress, offset and duration are set like at init, trigger starts the
+// transition at the next frame, switching to the preloaded source given if
+// any, and uniforms or the name of a uniform changes transition uniforms
+// from the next frame on.
+static int process_command(AVFilterContext *ctx, const char *cmd, const char *args,
+                           char *res, int res_len, int flags)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVDictionary *dict = NULL;
+  const AVDictionaryEntry *e = NULL;
+  int ret;
+
+  if (!strcmp(cmd, "trigger")) {
+    if (args && *args && (ret = select_transition(ctx, args)) < 0) {
+      return ret;
+    }
+    c->trigger = 1;
+    return 0;
+  }
+  if ((ret = ff_filter_process_command(ctx, cmd, args, res, res_len, flags)) != AVERROR(ENOSYS)) {
+    return ret;
+  }
+
+  // uniforms are looked up in the programs, built now if lead_time hasn't
+  // gotten to them yet
+  if (c->resources == RESOURCES_NONE) {
+    start_warm_up(ctx);
+  }
+  if (c->resources == RESOURCES_WARMING && (ret = finish_warm_up(ctx)) < 0) {
+    return ret;
+  }
+  if (c->cpu) {
+    av_log(ctx, AV_LOG_ERROR, "%s can't be changed: the CPU versions have no uniforms\n", cmd);
+    return AVERROR(ENOSYS);
+  }
+  if (strcmp(cmd, "uniforms")) {
+    return queue_uniform(ctx, cmd, args);
+  }
+  if ((ret = av_dict_parse_string(&dict, args, "=", ":", 0)) < 0) {
+    return ret;
+  }
+  while ((e = av_dict_get(dict, "", e, AV_DICT_IGNORE_SUFFIX)) && (ret = queue_uniform(ctx, e->key, e->value)) >= 0);
+  av_dict_free(&dict);
+  return ret;
+}
+
+static int query_formats(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  // 4 byte pixels first, they transfer without driver conversions, the
+  // driver's own layout ahead of the others
+  static const enum AVPixelFormat formats[] = {
+    AV_PIX_FMT_RGB32,
+    AV_PIX_FMT_0RGB32,
+    AV_PIX_FMT_RGBA,
+    AV_PIX_FMT_RGB0,
+    AV_PIX_FMT_RGB24,
+    AV_PIX_FMT_RGBA64,
+    AV_PIX_FMT_RGB48,
+#ifdef AV_PIX_FMT_X2RGB10
+    AV_PIX_FMT_X2RGB10,
+#endif
+    AV_PIX_FMT_YUV420P,
+    AV_PIX_FMT_NV12,
+    AV_PIX_FMT_P010,
+#ifdef GL_TRANSITION_HWMAP_DRM
+# if CONFIG_VAAPI
+    AV_PIX_FMT_VAAPI,
+# endif
+# if CONFIG_VULKAN
+    AV_PIX_FMT_VULKAN,
+# endif
+#endif
+#ifdef GL_TRANSITION_HWMAP_CUDA
+    AV_PIX_FMT_CUDA,
+#endif
+    AV_PIX_FMT_NONE
+  };
+  enum AVPixelFormat list[FF_ARRAY_ELEMS(formats)];
+
+  memcpy(list, formats, sizeof(formats));
+  if (c->backend != BACKEND_CPU) {
+    order_native_formats(ctx, list, FF_ARRAY_ELEMS(list) - 1);
+  }
+  return ff_set_common_formats(ctx, ff_make_format_list(list));
+}
+
+// Whether an input has signalled EOF and has no frames left on its link.
+static int input_ended(AVFilterLink *inLink)
+{
+  return ff_outlink_get_status(inLink) && !ff_inlink_queued_frames(inLink);
+}
+
+// Whether the next framesync run may end the output: an input stopping it
+// has ended, or all the inputs it syncs on have.
+static int output_ending(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  int i, synced = 1;
+
+  for (i = 0; i < ctx->nb_inputs; i++) {
+    if (input_ended(ctx->inputs[i]) && c->fs.in[i].after == EXT_STOP) {
+      return 1;
+    }
+    if (c->fs.in[i].sync && !input_ended(ctx->inputs[i])) {
+      synced = 0;
+    }
+  }
+  return synced;
+}
+
+static int activate(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  int ret, sent = 0;
+
+  // finished frames go out first, new ones are only taken while the render
+  // thread has room for them. max_inflight holds the thread back on its
+  // fences, which fills the queue.
+  if (c->renderRunning) {
+    if ((sent = drain_render_thread(ctx)) < 0) {
+      return sent;
+    }
+    // at the bound of the queue the thread doesn't touch the links, nothing
+    // outside would make the filter ready again
+    if (!sent && render_thread_full(c)) {
+      wait_render_thread(c);
+      if ((sent = drain_render_thread(ctx)) < 0) {
+        return sent;
+      }
+    }
+    // frames went out, come back for the input once they moved on
+    if (render_thread_full(c)) {
+      ff_filter_set_ready(ctx, 100);
+      return 0;
+    }
+  }
+
+  // with max_inflight, frames the GPU finished meanwhile don't wait for the
+  // next input to go out
+  if (!c->renderRunning && c->max_inflight && c->packQueued) {
+    make_current(c);
+    if ((ret = emit_finished_readbacks(ctx)) < 0) {
+      return ret;
+    }
+  }
+
+  // framesync sets EOF on the output itself, what is still held for
+  // readback must have gone out by then
+  if (output_ending(ctx)) {
+    if (!c->renderRunning && has_context(c)) {
+      make_current(c);
+    }
+    if ((ret = c->renderRunning ? finish_render_thread(ctx) : flush_readback(ctx)) < 0) {
+      return ret;
+    }
+  }
+
+  return ff_framesync_activate(&c->fs);
+}
+
+// Picks how much each input is shrunk by so that no more pixels than the
+// output shows of it are uploaded.
+static void init_prescale(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  int i, p;
+
+  for (p = 0; p < c->fmt->nb_planes; p++) {
+    if (!sample_bytes(&c->fmt->planes[p])) {
+      av_log(ctx, AV_LOG_WARNING, "prescale doesn't support %s\n", av_get_pix_fmt_name(c->fmt->pix_fmt));
+      return;
+    }
+  }
+  for (i = FROM; i <= TO; i++) {
+    AVFilterLink *inLink = ctx->inputs[i];
+    c->prescaleShift[i] = prescale_shift(c->resize, inLink->w, inLink->h, outLink->w, outLink->h);
+    if (c->prescaleShift[i]) {
+      av_log(ctx, AV_LOG_VERBOSE, "uploading input %d at %dx%d\n", i,
+             AV_CEIL_RSHIFT(inLink->w, c->prescaleShift[i]), AV_CEIL_RSHIFT(inLink->h, c->prescaleShift[i]));
+    }
+  }
+}
+
+// Creates the textures, targets and buffers frames are drawn with, which
+// lead_time keeps around the transition window only.
+static int create_frame_resources(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *fromLink = ctx->inputs[FROM];
+  AVFilterLink *toLink = ctx->inputs[TO];
+  int ret, i;
+
+  if ((ret = create_pass_targets(ctx)) < 0 || (ret = create_previous_target(ctx)) < 0) {
+    return ret;
+  }
+  create_frame_tex(c, FROM, AV_CEIL_RSHIFT(fromLink->w, c->prescaleShift[FROM]),
+                   AV_CEIL_RSHIFT(fromLink->h, c->prescaleShift[FROM]));
+  create_frame_tex(c, TO, AV_CEIL_RSHIFT(toLink->w, c->prescaleShift[TO]),
+                   AV_CEIL_RSHIFT(toLink->h, c->prescaleShift[TO]));
+
+  if ((ret = c->fmt->chroma ? create_yuv_targets(ctx) : create_rgb_target(ctx)) < 0) {
+    return ret;
+  }
+#ifdef GL_TRANSITION_HWMAP_CUDA
+  if (c->hwFormat == AV_PIX_FMT_CUDA && (ret = register_cuda_textures(ctx)) < 0) {
+    return ret;
+  }
+#endif
+
+  if (c->compute && (ret = create_compute_pack(ctx)) < 0) {
+    return ret;
+  }
+  if (c->output_pool && (c->computeProgram || c->batch > 1 || !c->shared || c->hwFormat != AV_PIX_FMT_NONE ||
+                         !GLEW_ARB_buffer_storage || !GLEW_ARB_sync)) {
+    av_log(ctx, AV_LOG_WARNING, "output_pool needs shared=1, GL_ARB_buffer_storage and GL_ARB_sync, "
+           "and has no effect with compute, batch and hardware frames\n");
+    c->output_pool = 0;
+  }
+  if ((c->readback_depth > 1 || c->computeProgram || c->output_pool) && (ret = create_pack_buffers(ctx)) < 0) {
+    return ret;
+  }
+  if (c->computeProgram) {
+    set_pack_layout(c);
+  }
+  if (c->batch > 1 && (ret = create_batch_queue(ctx)) < 0) {
+    return ret;
+  }
+  if (c->upload_depth > 1 && (ret = create_upload_ring(ctx)) < 0) {
+    return ret;
+  }
+  for (i = FROM; i <= TO && !c->uploadBuf; i++) {
+    if (c->prescaleShift[i] && !(c->prescaleBuf[i] = av_malloc(planes_size(c->fmt, ctx->inputs[i]->w, ctx->inputs[i]->h)))) {
+      return AVERROR(ENOMEM);
+    }
+  }
+  if (c->timing) {
+    estimate_gpu_memory(ctx);
+  }
+  return 0;
+}
+
+// Deletes what create_frame_resources() made, leaving the context and the
+// programs. Frames still queued for readback are dropped.
+static void release_frame_resources(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  int i;
+
+  delete_pass_targets(c);
+  if (c->prevTex)
+    glDeleteTextures(1, &c->prevTex);
+  c->prevTex = 0;
+  glDeleteTextures(MAX_PLANES, c->tex[FROM]);
+  glDeleteTextures(MAX_PLANES, c->tex[TO]);
+  glDeleteTextures(MAX_PLANES, c->planeTex);
+  memset(c->tex, 0, sizeof(c->tex));
+  memset(c->planeTex, 0, sizeof(c->planeTex));
+  if (c->rgbTex)
+    glDeleteTextures(1, &c->rgbTex);
+  if (c->rgbFbo)
+    glDeleteFramebuffers(1, &c->rgbFbo);
+  if (c->lumaFbo)
+    glDeleteFramebuffers(1, &c->lumaFbo);
+  if (c->chromaFbo)
+    glDeleteFramebuffers(1, &c->chromaFbo);
+  if (c->outFbo)
+    glDeleteFramebuffers(1, &c->outFbo);
+  c->rgbTex = c->rgbFbo = c->lumaFbo = c->chromaFbo = c->outFbo = 0;
+  if (c->lumaProgram)
+    glDeleteProgram(c->lumaProgram);
+  if (c->chromaProgram)
+    glDeleteProgram(c->chromaProgram);
+  if (c->computeProgram)
+    glDeleteProgram(c->computeProgram);
+  c->lumaProgram = c->chromaProgram = c->computeProgram = 0;
+
+  if (c->packBufs)
+    glDeleteBuffers(c->readback_depth, c->packBufs);
+  if (c->uploadFences) {
+    for (i = 0; i < c->upload_depth; i++)
+      if (c->uploadFences[i])
+        glDeleteSync(c->uploadFences[i]);
+  }
+  if (c->uploadBuf) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, c->uploadBuf);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glDeleteBuffers(1, &c->uploadBuf);
+  }
+  c->uploadBuf = 0;
+  c->uploadPtr = NULL;
+  c->uploadSlotSize = 0;
+  c->uploadHead = 0;
+  if (c->packFrames) {
+    for (i = 0; i < c->readback_depth; i++)
+      av_frame_free(&c->packFrames[i]);
+  }
+  destroy_output_pool(c);
+  c->packSize = 0;
+  c->packHead = c->packQueued = 0;
+  if (c->batchOut) {
+    for (i = 0; i < c->batch; i++) {
+      av_frame_free(&c->batchFrom[i]);
+      av_frame_free(&c->batchTo[i]);
+      av_frame_free(&c->batchOut[i]);
+    }
+  }
+  c->batchQueued = 0;
+  av_freep(&c->batchFrom);
+  av_freep(&c->batchTo);
+  av_freep(&c->batchOut);
+  av_freep(&c->batchProgress);
+  av_freep(&c->batchSeq);
+  av_freep(&c->packBufs);
+  av_freep(&c->packFrames);
+  av_freep(&c->uploadFences);
+  av_freep(&c->prescaleBuf[FROM]);
+  av_freep(&c->prescaleBuf[TO]);
+  av_frame_free(&c->uploaded[FROM]);
+  av_frame_free(&c->uploaded[TO]);
+  av_buffer_pool_uninit(&c->packPool);
+  av_buffer_pool_uninit(&c->batchPool);
+}
+
+// Sets up the GL context and everything rendering on it needs.
+static int config_gl(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  int ret;
+
+  // the display and share group come from the pool, query_formats may have
+  // taken them already, only the context and the surface it is made current
+  // with belong to this instance
+  if (!c->device && (ret = acquire_device(ctx, c->device_name)) < 0) {
+    return ret;
+  }
+
+#ifdef GL_TRANSITION_USING_EGL
+  c->eglDpy = c->device->dpy;
+  if (!c->device->surfaceless &&
+      (c->eglSurf = eglCreatePbufferSurface(c->eglDpy, c->device->cfg, pbufferAttribs)) == EGL_NO_SURFACE) {
+    av_log(ctx, AV_LOG_ERROR, "creating EGL surface failed\n");
+    return AVERROR_EXTERNAL;
+  }
+  eglBindAPI(EGL_OPENGL_API);
+  c->eglCtx = eglCreateContext(c->eglDpy, c->device->cfg, c->shared ? c->device->ctx : EGL_NO_CONTEXT, NULL);
+  if (c->eglCtx == EGL_NO_CONTEXT || !eglMakeCurrent(c->eglDpy, c->eglSurf, c->eglSurf, c->eglCtx)) {
+    av_log(ctx, AV_LOG_ERROR, "creating EGL context failed\n");
+    return AVERROR_EXTERNAL;
+  }
+#else
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+  c->window = glfwCreateWindow(1, 1, "", NULL, c->shared ? c->device->window : NULL);
+  if (!c->window) {
+    av_log(ctx, AV_LOG_ERROR, "setup_gl ERROR\n");
+    return -1;
+  }
+  glfwMakeContextCurrent(c->window);
 
-  return outFrame;
-}
+#endif
 
-static int blend_frame(FFFrameSync *fs)
-{
-  AVFilterContext *ctx = fs->parent;
-  GLTransitionContext *c = ctx->priv;
+#ifndef __APPLE__
+  // entry points are the same for every context of the device
+  ff_mutex_lock(&device_lock);
+  if (!c->device->glewReady) {
+    glewExperimental = GL_TRUE;
+    glewInit();
+    c->device->glewReady = 1;
+  }
+  ff_mutex_unlock(&device_lock);
 
-  AVFrame *fromFrame, *toFrame, *outFrame;
-  int ret;
+  if (c->batch > 1 && !GLEW_VERSION_3_0 && !GLEW_EXT_texture_array) {
+    av_log(ctx, AV_LOG_WARNING, "texture arrays not supported, not batching\n");
+    c->batch = 1;
+  }
+#endif
 
-  ret = ff_framesync_dualinput_get(fs, &fromFrame, &toFrame);
-  if (ret < 0) {
+#ifdef GL_TRANSITION_HWMAP_DRM
+  if (drm_frames(c) && (ret = init_drm_interop(ctx)) < 0) {
     return ret;
   }
+#endif
 
-  if (c->first_pts == AV_NOPTS_VALUE && fromFrame && fromFrame->pts != AV_NOPTS_VALUE) {
-    c->first_pts = fromFrame->pts;
+  glViewport(0, 0, outLink->w, outLink->h);
+  if (c->timing) {
+    init_timing(ctx);
   }
 
-  if (!toFrame) {
-    return ff_filter_frame(ctx->outputs[0], fromFrame);
+  if (c->transitions) {
+    if ((ret = build_transition_programs(ctx)) < 0) {
+      return ret;
+    }
+    use_transition(c, 0);
+  } else if((ret = build_program(ctx, c->source)) < 0) {
+    return ret;
+  }
+  glUseProgram(c->program);
+  c->posBuf = create_vbo(c);
+  if (!c->transitions && ((ret = init_uniforms(ctx)) < 0 || (ret = init_runtime_uniforms(ctx)) < 0)) {
+    return ret;
   }
 
-  outFrame = apply_transition(fs, ctx, fromFrame, toFrame);
-  if (!outFrame) {
-    return AVERROR(ENOMEM);
+  if (c->prescale) {
+    init_prescale(ctx);
+  }
+  if ((ret = create_frame_resources(ctx)) < 0) {
+    return ret;
   }
+  check_native_format(ctx);
+  return 0;
+}
+
+// lead_time: sets up what is missing for rendering, the context and the
+// programs the first time and the frame resources after a release.
+static int warm_up(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
 
-  return ff_filter_frame(ctx->outputs[0], outFrame);
+  if (!has_context(c)) {
+    return config_gl(ctx);
+  }
+  make_current(c);
+  return create_frame_resources(ctx);
 }
 
-static av_cold int init(AVFilterContext *ctx)
+#if HAVE_THREADS
+static void *warm_thread(void *arg)
 {
+  AVFilterContext *ctx = arg;
   GLTransitionContext *c = ctx->priv;
-  c->fs.on_event = blend_frame;
-  c->first_pts = AV_NOPTS_VALUE;
 
-  return 0;
+  c->warmResult = warm_up(ctx);
+  // finish_warm_up() makes it current again on the filter's thread
+  release_current(c);
+  return NULL;
 }
+#endif
 
-static av_cold void uninit(AVFilterContext *ctx) {
+// Starts setting up while the frames before the window keep passing
+// through, on a thread of its own with EGL, GLFW windows being created on
+// the main thread only.
+static void start_warm_up(AVFilterContext *ctx)
+{
   GLTransitionContext *c = ctx->priv;
-  ff_framesync_uninit(&c->fs);
-  
-  if (c->from)
-    glDeleteTextures(1, &c->from);
-  if (c->to)
-    glDeleteTextures(1, &c->to);
-  if (c->posBuf)
-    glDeleteBuffers(1, &c->posBuf);
-  if (c->program)
-    glDeleteProgram(c->program);
-  
-#ifdef GL_TRANSITION_USING_EGL
-  if (c->eglDpy) {
-    eglTerminate(c->eglDpy);
+
+  av_log(ctx, AV_LOG_VERBOSE, "setting up for the transition\n");
+  c->resources = RESOURCES_WARMING;
+#if HAVE_THREADS && defined(GL_TRANSITION_USING_EGL)
+  // a context is current on a single thread at a time
+  if (has_context(c)) {
+    release_current(c);
   }
-#else
-  if (c->window) {
-    glfwDestroyWindow(c->window);
+  if (!pthread_create(&c->warmThread, NULL, warm_thread, ctx)) {
+    c->warmRunning = 1;
+    return;
   }
 #endif
-
-  if (c->f_shader_source) {
-    av_freep(&c->f_shader_source);
-  }
+  c->warmResult = warm_up(ctx);
 }
 
-static int query_formats(AVFilterContext *ctx)
+static int finish_warm_up(AVFilterContext *ctx)
 {
-  static const enum AVPixelFormat formats[] = {
-    AV_PIX_FMT_RGB24,
-    AV_PIX_FMT_NONE
-  };
+  GLTransitionContext *c = ctx->priv;
 
-  return ff_set_common_formats(ctx, ff_make_format_list(formats));
+#if HAVE_THREADS
+  if (c->warmRunning) {
+    pthread_join(c->warmThread, NULL);
+    c->warmRunning = 0;
+  }
+#endif
+  c->resources = RESOURCES_READY;
+  if (has_context(c)) {
+    make_current(c);
+  }
+  if (c->warmResult >= 0) {
+    return 0;
+  }
+  // falls back to the CPU like config_output() does
+  if (c->backend == BACKEND_GL || c->transitions || !find_cpu_transition(ctx, c->source, 0)) {
+    return c->warmResult;
+  }
+  av_log(ctx, AV_LOG_WARNING, "OpenGL setup failed at pts %"PRId64" (%.3fs), rendering on the CPU from there\n",
+         c->fs.pts, c->fs.pts * av_q2d(c->fs.time_base));
+  release_frame_resources(ctx);
+  return config_cpu(ctx);
 }
 
-static int activate(AVFilterContext *ctx)
+// Sets up lead_time before the window at the latest and releases the frame
+// resources once it is over. Frames outside of it pass through meanwhile.
+static int schedule_resources(AVFilterContext *ctx, FFFrameSync *fs, float progress)
 {
   GLTransitionContext *c = ctx->priv;
-  return ff_framesync_activate(&c->fs);
+  int64_t pts = fs->pts - c->first_pts;
+  int draw = progress > 0.0f && progress < 1.0f;
+  int soon = pts >= c->windowStart - seconds_to_pts(c->lead_time, fs->time_base) && pts < c->windowEnd;
+  int ret;
+
+  if (c->cpu) {
+    return 0;
+  }
+  if ((draw || soon) && (c->resources == RESOURCES_NONE || c->resources == RESOURCES_RELEASED)) {
+    start_warm_up(ctx);
+  }
+  if (c->resources == RESOURCES_WARMING && (draw || !soon) && (ret = finish_warm_up(ctx)) < 0) {
+    return ret;
+  }
+  if (!draw && !soon && c->resources == RESOURCES_READY) {
+    if ((ret = flush_readback(ctx)) < 0) {
+      return ret;
+    }
+    make_current(c);
+    release_frame_resources(ctx);
+    c->resources = RESOURCES_RELEASED;
+    av_log(ctx, AV_LOG_VERBOSE, "released the frame resources\n");
+  }
+  return 0;
 }
 
 static int config_output(AVFilterLink *outLink)
@@ -556,11 +6010,19 @@ static int config_output(AVFilterLink *outLink)
   GLTransitionContext *c = ctx->priv;
   AVFilterLink *fromLink = ctx->inputs[FROM];
   AVFilterLink *toLink = ctx->inputs[TO];
-  int ret;
+  enum AVPixelFormat swFormat = outLink->format;
+  int ret, i;
 
-  if (fromLink->format != toLink->format) {
-    av_log(ctx, AV_LOG_ERROR, "inputs must be of same pixel format\n");
-    return AVERROR(EINVAL);
+  for (i = 1; i < ctx->nb_inputs; i++) {
+    if (ctx->inputs[i]->format != fromLink->format) {
+      av_log(ctx, AV_LOG_ERROR, "inputs must be of same pixel format\n");
+      return AVERROR(EINVAL);
+    }
+    // clips share the from/to textures and the uniforms of every transition
+    if (c->nb_clips && (ctx->inputs[i]->w != fromLink->w || ctx->inputs[i]->h != fromLink->h)) {
+      av_log(ctx, AV_LOG_ERROR, "clips must all have the same size\n");
+      return AVERROR(EINVAL);
+    }
   }
 
   if (c->w <= 0 || c->h <= 0) {
@@ -572,69 +6034,100 @@ static int config_output(AVFilterLink *outLink)
   outLink->h = c->h;
   // outLink->time_base = fromLink->time_base;
   outLink->frame_rate = fromLink->frame_rate;
-
-#ifdef GL_TRANSITION_USING_EGL
-  //init EGL
-  // 1. Initialize EGL
-  c->eglDpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
-  EGLint major, minor;
-  eglInitialize(c->eglDpy, &major, &minor);
-  av_log(ctx, AV_LOG_DEBUG, "%d%d", major, minor);
-  
-  // 2. Select an appropriate configuration  
-  EGLint numConfigs;
-  EGLint pbufferAttribs[] = {
-      EGL_WIDTH, outLink->w,
-      EGL_HEIGHT, outLink->h,
-      EGL_NONE,
-  };
-  eglChooseConfig(c->eglDpy, configAttribs, &c->eglCfg, 1, &numConfigs);
-  // 3. Create a surface
-  c->eglSurf = eglCreatePbufferSurface(c->eglDpy, c->eglCfg,
-                                       pbufferAttribs);
-  // 4. Bind the API
-  eglBindAPI(EGL_OPENGL_API);
-  // 5. Create a context and make it current
-  c->eglCtx = eglCreateContext(c->eglDpy, c->eglCfg, EGL_NO_CONTEXT, NULL);
-  eglMakeCurrent(c->eglDpy, c->eglSurf, c->eglSurf, c->eglCtx);
-#else
-  //glfw
-  if (!glfwInit())
-  {
-    return -1;
+  if (c->nb_clips) {
+    outLink->time_base = fromLink->time_base;
   }
-  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
-  c->window = glfwCreateWindow(outLink->w, outLink->h, "", NULL, NULL);
-  if (!c->window) {
-    av_log(ctx, AV_LOG_ERROR, "setup_gl ERROR\n");
-    return -1;
+  if (av_pix_fmt_desc_get(outLink->format)->flags & AV_PIX_FMT_FLAG_HWACCEL) {
+    if ((ret = config_hw_output(ctx)) < 0) {
+      return ret;
+    }
+    swFormat = ret;
   }
-  glfwMakeContextCurrent(c->window);
-
-#endif
 
-#ifndef __APPLE__
-  glewExperimental = GL_TRUE;
-  glewInit();
-#endif
+  for (i = 0; i < FF_ARRAY_ELEMS(transition_formats); i++) {
+    if (transition_formats[i].pix_fmt == swFormat) {
+      c->fmt = &transition_formats[i];
+    }
+  }
+  if (!c->fmt && c->hwFormat == AV_PIX_FMT_NONE) {
+    return AVERROR_BUG;
+  }
+  // the output planes are rendered into directly, only done for YUV
+  if (c->hwFormat != AV_PIX_FMT_NONE && (!c->fmt || !c->fmt->chroma)) {
+    av_log(ctx, AV_LOG_ERROR, "unsupported software format %s for hardware frames\n",
+           av_get_pix_fmt_name(swFormat));
+    return AVERROR(ENOSYS);
+  }
+  if (c->hwFormat != AV_PIX_FMT_NONE && (c->readback_depth > 1 || c->upload_depth > 1 || c->batch > 1 || c->prescale || c->compute)) {
+    av_log(ctx, AV_LOG_WARNING, "readback_depth, upload_depth, batch, prescale and compute have no effect on hardware frames\n");
+    c->readback_depth = c->upload_depth = c->batch = 1;
+    c->prescale = c->compute = 0;
+  }
+  // a batch is read back at once, there is nothing left for the ring to overlap
+  if (c->batch > 1 && c->readback_depth > 1) {
+    av_log(ctx, AV_LOG_WARNING, "readback_depth has no effect with batch\n");
+    c->readback_depth = 1;
+  }
+  // max_inflight sizes the rings, as their frames are the ones in flight
+  if (c->max_inflight && c->hwFormat == AV_PIX_FMT_NONE) {
+    if (c->batch > c->max_inflight) {
+      av_log(ctx, AV_LOG_WARNING, "batch limited to max_inflight %d\n", c->max_inflight);
+      c->batch = c->max_inflight;
+    }
+    c->readback_depth = c->batch > 1 ? 1 : c->max_inflight;
+    c->upload_depth = FFMIN(c->upload_depth, c->max_inflight);
+  }
 
-  glViewport(0, 0, outLink->w, outLink->h);
-  
-  if((ret = build_program(ctx)) < 0) {
+  // lead_time only works when the frames before and after the window can
+  // be passed through as they are
+  if (c->lead_time >= 0.0 &&
+      (c->backend == BACKEND_CPU || c->render_thread || c->hwFormat != AV_PIX_FMT_NONE ||
+       fromLink->w != outLink->w || fromLink->h != outLink->h || toLink->w != outLink->w || toLink->h != outLink->h)) {
+    av_log(ctx, AV_LOG_WARNING, "lead_time needs inputs in memory with the output size, and no render_thread "
+           "or CPU backend, setting up at once\n");
+    c->lead_time = -1.0;
+  }
+  // the frames around the window are not rendered at all with lead_time
+  if (c->lead_time >= 0.0 && !c->passthrough) {
+    av_log(ctx, AV_LOG_ERROR, "lead_time passes the frames outside of the transition through, it can't be used with passthrough=0\n");
+    return AVERROR(EINVAL);
+  }
+  c->passthrough = c->passthrough > 0 || c->lead_time >= 0.0;
+  ret = 0;
+  if (c->backend != BACKEND_CPU) {
+    if (c->lead_time >= 0.0) {
+      // only the device is opened now, so that a machine without a GPU
+      // falls back before the first frame rather than in the middle
+      c->resources = RESOURCES_NONE;
+      ret = c->device ? 0 : acquire_device(ctx, c->device_name);
+    } else {
+      ret = config_gl(ctx);
+    }
+    // a missing or broken GPU setup falls back to the CPU when allowed
+    if (ret < 0 && (c->backend == BACKEND_GL || c->transitions || c->hwFormat != AV_PIX_FMT_NONE ||
+                    !find_cpu_transition(ctx, c->source, 0))) {
+      return ret;
+    }
+    if (ret < 0) {
+      av_log(ctx, AV_LOG_WARNING, "OpenGL setup failed, rendering on the CPU\n");
+    }
+  }
+  if ((c->backend == BACKEND_CPU || ret < 0) && (ret = config_cpu(ctx)) < 0) {
     return ret;
   }
-  glUseProgram(c->program);
-  c->posBuf = create_vbo(c);
-  init_uniforms(ctx);
 
-  c->from = create_tex(fromLink->w, fromLink->h);
-  c->to = create_tex(toLink->w, toLink->h);  
+  av_log(ctx, AV_LOG_DEBUG, "ok: %s %dx%d %dx%d %dx%d\n", av_get_pix_fmt_name(outLink->format), fromLink->w, fromLink->h, toLink->w, toLink->h, outLink->w, outLink->h);
+  if (c->nb_clips) {
+    return 0;
+  }
+  if (c->render_thread && (ret = start_render_thread(ctx)) < 0) {
+    return ret;
+  }
 
   if ((ret = ff_framesync_init_dualinput(&c->fs, ctx)) < 0) {
     return ret;
   }
-  av_log(ctx, AV_LOG_DEBUG, "ok: %d %d %dx%d %dx%d %dx%d\n", c->from, c->to, fromLink->w, fromLink->h, toLink->w, toLink->h, outLink->w, outLink->h);
   
   return ff_framesync_configure(&c->fs);
 }
@@ -669,8 +6162,341 @@ AVFilter ff_vf_gltransition = {
   .uninit        = uninit,
   .query_formats = query_formats,
   .activate      = activate,
+  .process_command = process_command,
   .inputs        = gltransition_inputs,
   .outputs       = gltransition_outputs,
   .priv_class    = &gltransition_class,
-  .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC
+  .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC | AVFILTER_FLAG_SLICE_THREADS,
+  .flags_internal = FF_FILTER_FLAG_HWFRAME_AWARE,
+};
+
+// gltimeline: N clips joined by N-1 transitions in a single instance, so they
+// share one context, one set of textures and one readback path
+
+static const AVOption gltimeline_options[] = {
+  { "inputs", "number of clips", OFFSET(nb_clips), AV_OPT_TYPE_INT, {.i64=2}, 2, INT_MAX, FLAGS },
+  { "sources", "'|' separated gl-transition source files, empty for the basic fade", OFFSET(sources), AV_OPT_TYPE_STRING, {.str = NULL}, CHAR_MIN, CHAR_MAX, FLAGS },
+  { "durations", "'|' separated transition durations in seconds", OFFSET(durations), AV_OPT_TYPE_STRING, {.str = NULL}, CHAR_MIN, CHAR_MAX, FLAGS },
+  { "offsets", "'|' separated output times in seconds the transitions start at", OFFSET(offsets), AV_OPT_TYPE_STRING, {.str = NULL}, CHAR_MIN, CHAR_MAX, FLAGS },
+  { "cache_dir", "directory keeping compiled program binaries across runs", OFFSET(cache_dir), AV_OPT_TYPE_STRING, {.str = NULL}, CHAR_MIN, CHAR_MAX, FLAGS },
+  { "device", "EGL device index or DRM node to render on, or auto", OFFSET(device_name), AV_OPT_TYPE_STRING, {.str = NULL}, CHAR_MIN, CHAR_MAX, FLAGS },
+  { "w", "Output video width", OFFSET(w),    AV_OPT_TYPE_INT, {.i64=0}, 0,8192, FLAGS },
+  { "h", "Output video height", OFFSET(h),    AV_OPT_TYPE_INT, {.i64=0}, 0,8192, FLAGS },
+  { "readback_depth", "number of frames read back asynchronously (adds depth-1 frames of delay)", OFFSET(readback_depth), AV_OPT_TYPE_INT, {.i64=1}, 1, 16, FLAGS },
+  { "shared", "share GL objects with the other instances", OFFSET(shared), AV_OPT_TYPE_BOOL, {.i64=1}, 0, 1, FLAGS },
+  { "upload_depth", "number of frame pairs uploaded through a persistently mapped ring", OFFSET(upload_depth), AV_OPT_TYPE_INT, {.i64=1}, 1, 16, FLAGS },
+  { "prescale", "shrink inputs larger than drawn before uploading them", OFFSET(prescale), AV_OPT_TYPE_BOOL, {.i64=0}, 0, 1, FLAGS },
+  { "compute", "pack YUV output planes with a compute shader and read them back at once", OFFSET(compute), AV_OPT_TYPE_BOOL, {.i64=0}, 0, 1, FLAGS },
+  { "output_pool", "number of output frames read straight into a persistently mapped buffer", OFFSET(output_pool), AV_OPT_TYPE_INT, {.i64=0}, 0, 64, FLAGS },
+  { "max_inflight", "frames on the GPU at most, sizing the rings (0 leaves them as set)", OFFSET(max_inflight), AV_OPT_TYPE_INT, {.i64=0}, 0, 16, FLAGS, "max_inflight" },
+  { "live", "one frame at a time, for the lowest latency", 0, AV_OPT_TYPE_CONST, {.i64=1}, 0, 0, FLAGS, "max_inflight" },
+  { "throughput", "four frames overlapping", 0, AV_OPT_TYPE_CONST, {.i64=4}, 0, 0, FLAGS, "max_inflight" },
+  { "batch", "number of frames drawn before reading them back in one transfer", OFFSET(batch), AV_OPT_TYPE_INT, {.i64=1}, 1, 16, FLAGS },
+  { "timing", "export per stage GPU and CPU times as frame metadata", OFFSET(timing), AV_OPT_TYPE_BOOL, {.i64=0}, 0, 1, FLAGS },
+  { "resize", "resize mode", OFFSET(resize), AV_OPT_TYPE_INT, {.i64=0}, 0, RESIZE_NB-1, FLAGS, "resize" },
+  { "contain", "contain", 0, AV_OPT_TYPE_CONST, {.i64=CONTAIN}, 0, 0, FLAGS, "resize" },
+  { "cover", "cover", 0, AV_OPT_TYPE_CONST, {.i64=COVER}, 0, 0, FLAGS, "resize" },
+  { "stretch", "stretch", 0, AV_OPT_TYPE_CONST, {.i64=STRETCH}, 0, 0, FLAGS, "resize" },
+  {NULL}
+};
+
+AVFILTER_DEFINE_CLASS(gltimeline);
+
+static av_cold int timeline_init(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  const char *sources = c->sources;
+  const char *durations = c->durations;
+  const char *offsets = c->offsets;
+  double end = 0;
+  char *item;
+  int i, ret;
+
+  if ((ret = init(ctx)) < 0) {
+    return ret;
+  }
+  // the clips are rendered from the start, there is nothing to defer
+  c->lead_time = -1.0;
+
+  c->nb_transitions = c->nb_clips - 1;
+  c->transitions = av_calloc(c->nb_transitions, sizeof(*c->transitions));
+  c->clipShift = av_malloc_array(c->nb_clips, sizeof(*c->clipShift));
+  c->clipEof = av_calloc(c->nb_clips, sizeof(*c->clipEof));
+  if (!c->transitions || !c->clipShift || !c->clipEof) {
+    return AVERROR(ENOMEM);
+  }
+
+  for (i = 0; i < c->nb_clips - 1; i++) {
+    TimelineTransition *t = &c->transitions[i];
+
+    if ((ret = list_item(&sources, &t->source)) < 0) {
+      return ret;
+    }
+
+    if ((ret = list_item(&durations, &item)) < 0) {
+      return ret;
+    }
+    t->duration = item ? strtod(item, NULL) : 1.0;
+    av_free(item);
+
+    if ((ret = list_item(&offsets, &item)) < 0) {
+      return ret;
+    }
+    if (!item) {
+      av_log(ctx, AV_LOG_ERROR, "missing offset of transition %d\n", i);
+      return AVERROR(EINVAL);
+    }
+    t->offset = strtod(item, NULL);
+    av_free(item);
+
+    if (t->duration <= 0 || t->offset < end) {
+      av_log(ctx, AV_LOG_ERROR, "transition %d must last and start after the previous one ends\n", i);
+      return AVERROR(EINVAL);
+    }
+    end = t->offset + t->duration;
+  }
+
+  for (i = 0; i < c->nb_clips; i++) {
+    AVFilterPad pad = { 0 };
+
+    pad.type = AVMEDIA_TYPE_VIDEO;
+    if (!(pad.name = av_asprintf("input%d", i))) {
+      return AVERROR(ENOMEM);
+    }
+    if ((ret = ff_insert_inpad(ctx, i, &pad)) < 0) {
+      av_freep(&pad.name);
+      return ret;
+    }
+    c->clipShift[i] = AV_NOPTS_VALUE;
+  }
+
+  return 0;
+}
+
+static int64_t timeline_pts(AVFilterContext *ctx, double t)
+{
+  return seconds_to_pts(t, ctx->outputs[0]->time_base);
+}
+
+// Gets the next frame of a clip with its pts moved to the output timeline.
+// Returns 1 with a frame, 0 when it has been requested and AVERROR_EOF once
+// the clip ended.
+static int next_clip_frame(AVFilterContext *ctx, int clip, AVFrame **frame)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *inLink = ctx->inputs[clip];
+  int64_t pts;
+  int ret, status;
+
+  if (c->clipEof[clip]) {
+    return AVERROR_EOF;
+  }
+  if ((ret = ff_inlink_consume_frame(inLink, frame)) < 0) {
+    return ret;
+  }
+  if (ret) {
+    pts = av_rescale_q((*frame)->pts, inLink->time_base, ctx->outputs[0]->time_base);
+    // the first clip starts the output, the others the transition into them
+    if (c->clipShift[clip] == AV_NOPTS_VALUE) {
+      c->clipShift[clip] = (clip ? timeline_pts(ctx, c->transitions[clip - 1].offset) : 0) - pts;
+    }
+    (*frame)->pts = pts + c->clipShift[clip];
+    return 1;
+  }
+  if (ff_inlink_acknowledge_status(inLink, &status, &pts)) {
+    c->clipEof[clip] = 1;
+    return AVERROR_EOF;
+  }
+  ff_inlink_request_frame(inLink);
+  return 0;
+}
+
+static int keep_last(GLTransitionContext *c, const AVFrame *frame)
+{
+  av_frame_free(&c->last);
+  return (c->last = av_frame_clone(frame)) ? 0 : AVERROR(ENOMEM);
+}
+
+// Moves on to the next clip once the transition into it is over.
+static void next_clip(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+
+  ff_inlink_set_status(ctx->inputs[c->clip], AVERROR_EOF);
+  c->clipEof[c->clip] = 1;
+  c->clip++;
+  av_frame_free(&c->pending);
+  av_frame_free(&c->last);
+  c->last = c->toCur;
+  c->pending = c->toNext;
+  c->toCur = c->toNext = NULL;
+}
+
+// Shows a frame of the current clip alone, rendering it only when it can't
+// be sent as is. Returns 1 when done.
+static int show_clip_frame(AVFilterContext *ctx, AVFrame *frame)
+{
+  GLTransitionContext *c = ctx->priv;
+  int ret;
+
+  if ((ret = keep_last(c, frame)) < 0) {
+    av_frame_free(&frame);
+    return ret;
+  }
+  if ((ret = pass_through(ctx, frame, frame, 0.0f)) == 0) {
+    use_transition(c, FFMIN(c->clip, c->nb_clips - 2));
+    ret = apply_transition(ctx, frame, frame, 0.0f);
+  }
+  return ret < 0 ? ret : 1;
+}
+
+static int show_transition_frame(AVFilterContext *ctx, AVFrame *fromFrame, const AVFrame *toFrame)
+{
+  GLTransitionContext *c = ctx->priv;
+  const TimelineTransition *t = &c->transitions[c->clip];
+  int64_t start = timeline_pts(ctx, t->offset);
+  int64_t end = timeline_pts(ctx, t->offset + t->duration);
+  int ret;
+
+  use_transition(c, c->clip);
+  ret = apply_transition(ctx, fromFrame, toFrame, window_progress(fromFrame->pts, start, end));
+  return ret < 0 ? ret : 1;
+}
+
+// Produces the next output frame, returns 1 once a frame has been used and
+// 0 when waiting for input.
+static int timeline_step(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  AVFilterLink *outLink = ctx->outputs[0];
+  AVFrame *frame;
+  int ret;
+
+  for (;;) {
+    const TimelineTransition *t;
+    int64_t start, end;
+
+    if (!c->pending && (ret = next_clip_frame(ctx, c->clip, &c->pending)) <= 0 && ret != AVERROR_EOF) {
+      return ret;
+    }
+
+    if (c->clip == c->nb_clips - 1) {
+      if (c->pending) {
+        frame = c->pending;
+        c->pending = NULL;
+        return show_clip_frame(ctx, frame);
+      }
+      if ((ret = flush_readback(ctx)) < 0) {
+        return ret;
+      }
+      ff_outlink_set_status(outLink, AVERROR_EOF, c->last ? c->last->pts : AV_NOPTS_VALUE);
+      return 0;
+    }
+
+    t = &c->transitions[c->clip];
+    start = timeline_pts(ctx, t->offset);
+    end = timeline_pts(ctx, t->offset + t->duration);
+
+    if (c->pending && c->pending->pts < start) {
+      frame = c->pending;
+      c->pending = NULL;
+      return show_clip_frame(ctx, frame);
+    }
+
+    if (c->pending) {
+      // transition to the latest frame of the next clip not after this one
+      while (!c->toNext || c->toNext->pts <= c->pending->pts) {
+        if (c->toNext) {
+          av_frame_free(&c->toCur);
+          c->toCur = c->toNext;
+          c->toNext = NULL;
+        }
+        if ((ret = next_clip_frame(ctx, c->clip + 1, &c->toNext)) == AVERROR_EOF) {
+          break;
+        }
+        if (ret <= 0) {
+          return ret;
+        }
+      }
+      if (c->pending->pts >= end) {
+        next_clip(ctx);
+        continue;
+      }
+      frame = c->pending;
+      c->pending = NULL;
+      // an empty next clip leaves nothing to transition to
+      if (!c->toCur) {
+        return show_clip_frame(ctx, frame);
+      }
+      if ((ret = keep_last(c, frame)) < 0) {
+        av_frame_free(&frame);
+        return ret;
+      }
+      return show_transition_frame(ctx, frame, c->toCur);
+    }
+
+    // the clip ended before the transition did, its last frame stays up
+    // while the next clip drives the output
+    if (!c->toNext && (ret = next_clip_frame(ctx, c->clip + 1, &c->toNext)) <= 0) {
+      if (ret != AVERROR_EOF) {
+        return ret;
+      }
+      next_clip(ctx);
+      continue;
+    }
+    if (c->toNext->pts >= end || !c->last) {
+      next_clip(ctx);
+      continue;
+    }
+    if (!(frame = av_frame_clone(c->last))) {
+      return AVERROR(ENOMEM);
+    }
+    frame->pts = c->toNext->pts;
+    av_frame_free(&c->toCur);
+    c->toCur = c->toNext;
+    c->toNext = NULL;
+    return show_transition_frame(ctx, frame, c->toCur);
+  }
+}
+
+static int timeline_activate(AVFilterContext *ctx)
+{
+  GLTransitionContext *c = ctx->priv;
+  int ret;
+
+  FF_FILTER_FORWARD_STATUS_BACK_ALL(ctx->outputs[0], ctx);
+
+  c->blendStart = av_gettime_relative();
+  if ((ret = timeline_step(ctx)) < 0) {
+    return ret;
+  }
+  // the frames already queued may be enough for the next one
+  if (ret > 0) {
+    ff_filter_set_ready(ctx, 100);
+  }
+  return 0;
+}
+
+static const AVFilterPad gltimeline_outputs[] = {
+  {
+    .name = "default",
+    .type = AVMEDIA_TYPE_VIDEO,
+    .config_props = config_output,
+  },
+  {NULL}
+};
+
+AVFilter ff_vf_gltimeline = {
+  .name          = "gltimeline",
+  .description   = NULL_IF_CONFIG_SMALL("OpenGL transitions between consecutive clips"),
+  .priv_size     = sizeof(GLTransitionContext),
+  .init          = timeline_init,
+  .uninit        = uninit,
+  .query_formats = query_formats,
+  .activate      = timeline_activate,
+  .inputs        = NULL,
+  .outputs       = gltimeline_outputs,
+  .priv_class    = &gltimeline_class,
+  .flags         = AVFILTER_FLAG_DYNAMIC_INPUTS,
+  .flags_internal = FF_FILTER_FLAG_HWFRAME_AWARE,
 };